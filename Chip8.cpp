@@ -27,51 +27,38 @@
 */
 
 #include "Chip8.h"
+#ifdef CHIP8_TRACE
+#include "Chip8Trace.h"
+#endif
 #include <iostream>
 #include <fstream>
 #include <iterator>
-#include <random>
 #include <sstream>
 #include <bitset>
-
-//Thanks @fallahn for this snippet! 
-std::default_random_engine rndEngine(static_cast<unsigned long>(std::time(0)));
-std::uniform_int_distribution<unsigned short> distribution(0, 0xFF);
-sf::Uint16 randNext() { return distribution(rndEngine); }
-
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
 
 Chip8::Chip8() {
-	pc = CHIP8_PROGRAM_START;
-	indexRegister = 0;
-
-	delayTimer = 0;
-	soundTimer = 0;
-
-	error = false;
+	codeListener = nullptr;
 
-	clearScreen();
+#ifdef CHIP8_TRACE
+	tracer = nullptr;
+#endif
 
-	kbdmap[0x1] = sf::Keyboard::Key::Num1;
-	kbdmap[0x2] = sf::Keyboard::Key::Num2;
-	kbdmap[0x3] = sf::Keyboard::Key::Num3;
-	kbdmap[0xC] = sf::Keyboard::Key::Num4;
+	//Memory, screen, registers, stack and timers all start at zero
+	std::memset(&state, 0, sizeof(state));
+	rehashMemory();
 
-	kbdmap[0x4] = sf::Keyboard::Key::Q;
-	kbdmap[0x5] = sf::Keyboard::Key::W;
-	kbdmap[0x6] = sf::Keyboard::Key::E;
-	kbdmap[0xD] = sf::Keyboard::Key::R;
+	state.pc = CHIP8_PROGRAM_START;
+	state.instructionsUntilTick = 1;
+	state.running = true;
 
-	kbdmap[0x7] = sf::Keyboard::Key::A;
-	kbdmap[0x8] = sf::Keyboard::Key::S;
-	kbdmap[0x9] = sf::Keyboard::Key::D;
-	kbdmap[0xE] = sf::Keyboard::Key::F;
+	seedRandom(CHIP8_DEFAULT_SEED);
 
-	kbdmap[0xA] = sf::Keyboard::Key::Z;
-	kbdmap[0x0] = sf::Keyboard::Key::X;
-	kbdmap[0xB] = sf::Keyboard::Key::C;
-	kbdmap[0xF] = sf::Keyboard::Key::V;
+	fusionCounts.fill(0);
 
-	running = true;
+	clearScreen();
 
 	cycles = CHIP8_DEFAULT_CYCLES;
 }
@@ -94,13 +81,13 @@ bool Chip8::loadFromFile(const std::string & filename) {
 	data.reserve(fileSize);
 
 	data.insert(data.begin(),
-		std::istream_iterator<sf::Uint8>(file),
-		std::istream_iterator<sf::Uint8>());
+		std::istream_iterator<uint8_t>(file),
+		std::istream_iterator<uint8_t>());
 
 	return true;
 }
 
-void Chip8::loadFromMemory(const sf::Uint8 * mem, std::size_t sz) {
+void Chip8::loadFromMemory(const uint8_t * mem, std::size_t sz) {
 	data.clear();
 	data.reserve(sz);
 	for (std::size_t i = 0; i < sz; i++) {
@@ -108,583 +95,1230 @@ void Chip8::loadFromMemory(const sf::Uint8 * mem, std::size_t sz) {
 	}
 }
 
-void Chip8::prepare(sf::RenderWindow & target) {
-	this->window = &target;
+void Chip8::prepare() {
+	state.memory.fill(0);
+
+	std::memcpy(state.memory.data(), fontset.data(), fontset.size());
+
+	std::memcpy(&state.memory[CHIP8_PROGRAM_START], data.data(), std::min<std::size_t>(data.size(), CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START));
+	rehashMemory();
+	state.registers.fill(0);
+	state.stack.fill(0);
 
-	std::memcpy(memory.data(), fontset.data(), fontset.size());
+	allocateCache();
 
-	std::memcpy(&memory[CHIP8_PROGRAM_START], data.data(), data.size());
-	std::memset(registers.data(), 0u, CHIP8_REGISTERS);
-	std::memset(stack.data(), 0u, CHIP8_STACK_SIZE);
+	for (auto& ins : cache->decoded) {
+		ins.handler = nullptr;
+	}
+
+	clearBlocks();
+
+	state.instructionCredit = 0;
+
+	state.tickCredit = 0;
+	state.instructionsUntilTick = 0;
+
+	while (state.instructionsUntilTick == 0) {
+		scheduleTick();
+	}
+
+	fusionCounts.fill(0);
 }
 
-void Chip8::execute() {
-	Opcode opcode = memory[pc] << 8 | memory[pc + 1];
-	
-	sf::Uint8 byte1 = opcode & 0xFF00;
-	sf::Uint8 byte2 = opcode & 0x00FF;
-
-	sf::Uint16 optype = opcode & 0xF000;
-
-	/*
-	00E0 - CLS
-	Clear the display.	
-	*/
-	if (opcode == Chip8Opcodes::ClearScreen) {
-		clearScreen();
-		advance(2);
-		return;
+/*
+	Opcode dispatch tables.
+
+	The high nibble of an opcode selects the handler from primaryHandlers.
+	Families that share a high nibble (0x0, 0x8, 0xE, 0xF) are left empty there
+	and resolved in decode() through a second table keyed on the low nibble
+	or the low byte.
+*/
+const std::array<Chip8::OpcodeHandler, 16> Chip8::primaryHandlers = {
+	nullptr,
+	&Chip8::opJump,
+	&Chip8::opSubroutineCall,
+	&Chip8::opSkipIfEqual,
+	&Chip8::opSkipIfNotEqual,
+	&Chip8::opSkipIfRegistersEqual,
+	&Chip8::opSetRegister,
+	&Chip8::opRegisterAdd,
+	nullptr,
+	&Chip8::opSkipIfRegistersNotEqual,
+	&Chip8::opSetIndexRegister,
+	&Chip8::opSetProgramCounterPlusV0,
+	&Chip8::opGenRandom,
+	&Chip8::opDrawSprite,
+	nullptr,
+	nullptr
+};
+
+const std::array<Chip8::OpcodeHandler, 16> Chip8::registerHandlers = {
+	&Chip8::opAssignRegisters,
+	&Chip8::opBitwiseOr,
+	&Chip8::opBitwiseAnd,
+	&Chip8::opBitwiseXor,
+	&Chip8::opAddRegisterAndSetCarry,
+	&Chip8::opSubtractRegisterAndSetCarry,
+	&Chip8::opDivideLSB,
+	&Chip8::opSubtractRegisterAndSetCarryYX,
+	&Chip8::unknownOpcode,
+	&Chip8::unknownOpcode,
+	&Chip8::unknownOpcode,
+	&Chip8::unknownOpcode,
+	&Chip8::unknownOpcode,
+	&Chip8::unknownOpcode,
+	&Chip8::opMultiplyMSB,
+	&Chip8::unknownOpcode
+};
+
+std::array<Chip8::OpcodeHandler, 256> Chip8::makeByteTable(std::initializer_list<std::pair<uint8_t, OpcodeHandler>> entries) {
+	std::array<Chip8::OpcodeHandler, 256> table;
+	table.fill(&Chip8::unknownOpcode);
+
+	for (auto& entry : entries) {
+		table[entry.first] = entry.second;
 	}
 
-	/*
-	00EE - RET
-	Return from a subroutine.
-	*/
-	if (opcode == Chip8Opcodes::Return) {
-		pc = pop();
-		advance(2);
-		return;
+	return table;
+}
+
+const std::array<Chip8::OpcodeHandler, 256> Chip8::systemHandlers = makeByteTable({
+	{ Chip8Opcodes::ClearScreen & 0xFF, &Chip8::opClearScreen },
+	{ Chip8Opcodes::Return & 0xFF, &Chip8::opReturn }
+});
+
+const std::array<Chip8::OpcodeHandler, 256> Chip8::keyboardHandlers = makeByteTable({
+	{ Chip8Opcodes::SkipIfKeyIsPressed & 0xFF, &Chip8::opSkipIfKeyIsPressed },
+	{ Chip8Opcodes::SkipIfKeyIsNotPressed & 0xFF, &Chip8::opSkipIfKeyIsNotPressed }
+});
+
+const std::array<Chip8::OpcodeHandler, 256> Chip8::miscHandlers = makeByteTable({
+	{ Chip8Opcodes::GetDelayTimerValue & 0xFF, &Chip8::opGetDelayTimerValue },
+	{ Chip8Opcodes::WaitKeyPress & 0xFF, &Chip8::opWaitKeyPress },
+	{ Chip8Opcodes::SetDelayTimer & 0xFF, &Chip8::opSetDelayTimer },
+	{ Chip8Opcodes::SetSoundTimer & 0xFF, &Chip8::opSetSoundTimer },
+	{ Chip8Opcodes::IndexAdd & 0xFF, &Chip8::opIndexAdd },
+	{ Chip8Opcodes::IndexSetFont & 0xFF, &Chip8::opIndexSetFont },
+	{ Chip8Opcodes::IndexBCD & 0xFF, &Chip8::opIndexBCD },
+	{ Chip8Opcodes::RegistersToMemory & 0xFF, &Chip8::opRegistersToMemory },
+	{ Chip8Opcodes::MemoryToRegisters & 0xFF, &Chip8::opMemoryToRegisters }
+});
+
+Chip8::DecodedInstruction Chip8::decode(unsigned int address) const {
+	DecodedInstruction ins;
+
+	ins.opcode = state.memory[address] << 8 | state.memory[(address + 1) % CHIP8_MEMORY_SIZE];
+	ins.x = (ins.opcode & 0x0F00) >> 8;
+	ins.y = (ins.opcode & 0x00F0) >> 4;
+	ins.n = ins.opcode & 0x000F;
+	ins.kk = ins.opcode & 0x00FF;
+	ins.nnn = ins.opcode & 0x0FFF;
+
+	switch (ins.opcode >> 12) {
+		//0nnn family: only 00E0 and 00EE are supported
+		case 0x0:
+			ins.handler = ins.x == 0 ? systemHandlers[ins.kk] : &Chip8::unknownOpcode;
+			break;
+		//8xyN family, selected by the last nibble
+		case 0x8:
+			ins.handler = registerHandlers[ins.n];
+			break;
+		//ExNN family, selected by the last byte
+		case 0xE:
+			ins.handler = keyboardHandlers[ins.kk];
+			break;
+		//FxNN family, selected by the last byte
+		case 0xF:
+			ins.handler = miscHandlers[ins.kk];
+			break;
+		default:
+			ins.handler = primaryHandlers[ins.opcode >> 12];
+			break;
 	}
-	
-	/*
-	1nnn - JP addr
-	Jump to location nnn.
-	*/
-	if (optype == Chip8Opcodes::Jump) {
-		pc = opcode & 0x0FFF;
-		return;
+
+	ins.endsBlock = ins.handler == &Chip8::opJump
+		|| ins.handler == &Chip8::opSubroutineCall
+		|| ins.handler == &Chip8::opReturn
+		|| ins.handler == &Chip8::opSetProgramCounterPlusV0
+		|| ins.handler == &Chip8::opSkipIfEqual
+		|| ins.handler == &Chip8::opSkipIfNotEqual
+		|| ins.handler == &Chip8::opSkipIfRegistersEqual
+		|| ins.handler == &Chip8::opSkipIfRegistersNotEqual
+		|| ins.handler == &Chip8::opSkipIfKeyIsPressed
+		|| ins.handler == &Chip8::opSkipIfKeyIsNotPressed
+		|| ins.handler == &Chip8::opWaitKeyPress //does not advance until a key is down
+		|| ins.handler == &Chip8::opIndexBCD //memory writes may invalidate the block itself
+		|| ins.handler == &Chip8::opRegistersToMemory
+		|| ins.handler == &Chip8::unknownOpcode;
+
+	return ins;
+}
+
+//Kept for the lifetime of the machine once allocated, engines may hold on to the entries
+void Chip8::allocateCache() {
+	if (!cache) {
+		cache.reset(new CodeCache());
 	}
+}
 
-	/*
-	2nnn - CALL addr
-	Call subroutine at nnn.
-	*/
-	if (optype == Chip8Opcodes::SubroutineCall) {
-		push(pc);
+const Chip8::DecodedInstruction& Chip8::decodedAt(unsigned int address) {
+	DecodedInstruction& ins = cache->decoded[address];
 
-		pc = opcode & 0x0FFF;
-		return;
+	if (!ins.handler) {
+		ins = decode(address);
 	}
 
-	/*
-	3xkk - SE Vx, byte
-	Skip next instruction if Vx = kk.
-	*/
-	if (optype == Chip8Opcodes::SkipIfEqual) {
-		if (registers[(opcode & 0x0F00) >> 8] == byte2) {
-			advance(4);
-		} else {
-			advance(2);
-		}
-		return;
+	return ins;
+}
+
+//A byte belongs to the instruction starting at it and to the one starting just before it
+void Chip8::invalidateDecoded(unsigned int address) {
+	address %= CHIP8_MEMORY_SIZE;
+
+	cache->decoded[address].handler = nullptr;
+	cache->decoded[(address + CHIP8_MEMORY_SIZE - 1) % CHIP8_MEMORY_SIZE].handler = nullptr;
+
+	//Self-modifying code is rare, so any write into a built block drops all of them
+	if (cache->blockCode[address]) {
+		clearBlocks();
 	}
 
-	/*
-	4xkk - SNE Vx, byte
-	Skip next instruction if Vx != kk.
-	*/
-	if (optype == Chip8Opcodes::SkipIfNotEqual) {
-		if (registers[(opcode & 0x0F00) >> 8] != byte2) {
-			advance(4);
-		}
-		else {
-			advance(2);
-		}
+	if (codeListener) {
+		codeListener->invalidate(address);
+	}
+}
+
+//A key per (address, value) pair, mixed like splitmix64 instead of looked up in a 1 MB table
+static uint64_t memoryKey(unsigned int address, uint8_t value) {
+	uint64_t key = (static_cast<uint64_t>(address) << 8 | value) * 0x9E3779B97F4A7C15ull;
+
+	key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ull;
+	key = (key ^ (key >> 27)) * 0x94D049BB133111EBull;
+
+	return key ^ (key >> 31);
+}
+
+void Chip8::writeMemory(unsigned int address, uint8_t value) {
+	address &= 0x0FFF;
+
+	memoryHash ^= memoryKey(address, state.memory[address]) ^ memoryKey(address, value);
+	state.memory[address] = value;
+
+	invalidateDecoded(address);
+}
+
+void Chip8::rehashMemory() {
+	memoryHash = 0;
+
+	for (unsigned int address = 0; address < CHIP8_MEMORY_SIZE; address++) {
+		memoryHash ^= memoryKey(address, state.memory[address]);
+	}
+}
+
+void Chip8::execute() {
+	if (state.pc >= CHIP8_MEMORY_SIZE) {
+		fail("Out of memory.");
 		return;
 	}
 
-	/*
-	5xy0 - SE Vx, Vy
-	Skip next instruction if Vx = Vy.
-	*/
-	if (optype == Chip8Opcodes::SkipIfRegistersEqual) {
-		auto reg1 = (opcode & 0x0F00) >> 8;
-		auto reg2 = (opcode & 0x00F0) >> 4;
+	const DecodedInstruction& ins = decodedAt(state.pc);
 
-		if (registers[reg1] == registers[reg2]) {
-			advance(4);
-		} else {
-			advance(2);
+#ifdef CHIP8_TRACE
+	const uint16_t pc = state.pc;
+
+	(this->*ins.handler)(ins);
+
+	if (tracer) tracer->instruction(pc, ins.opcode, state);
+#else
+	(this->*ins.handler)(ins);
+#endif
+}
+
+/*
+	Basic block engine.
+
+	Code is split into straight-line blocks that end at an instruction which
+	may change the control flow (see DecodedInstruction::endsBlock).
+	A block is run as call-threaded code: its handlers are invoked back to back
+	from the decoded cache, without the per-instruction validity and memory checks
+	done by execute(). With GCC and Clang, runThreaded() instead jumps from
+	handler to handler with computed goto and goes on to the next block
+	without returning here. MSVC has no computed goto, so there every block
+	goes through runBlock() and member function pointers.
+
+	Runs are cut at every timer tick, so a tick happens after the same
+	instruction as on the interpreter. Returns the number of executed instructions.
+*/
+unsigned long Chip8::executeBlocks(unsigned long maxInstructions) {
+	unsigned long executed = 0;
+
+	while (state.running && executed < maxInstructions) {
+		unsigned long slice = std::min<unsigned long>(maxInstructions - executed, state.instructionsUntilTick);
+		unsigned long ran = state.pc < CHIP8_MEMORY_SIZE && cache->idleCandidates[state.pc] ? skipIdleLoop(slice) : 0;
+
+#ifdef CHIP8_TRACE
+		if (ran && tracer) tracer->idle(state.pc, ran);
+#endif
+
+#ifdef CHIP8_THREADED_DISPATCH
+#ifdef CHIP8_TRACE
+		if (!ran && !tracer) ran = runThreaded(slice);
+#else
+		if (!ran) ran = runThreaded(slice);
+#endif
+#endif
+
+		if (!ran) {
+			ran = runBlock(slice);
 		}
 
-		return;
+		executed += ran;
+		countInstructions(ran);
 	}
 
-	/*
-	6xkk - LD Vx, byte
-	Set Vx = kk.
-	*/
-	if (optype == Chip8Opcodes::SetRegister) {
-		int reg = (opcode & 0x0F00) >> 8;
+	return executed;
+}
 
-		registers[reg] = byte2;
+//Interpreter loop, one instruction at a time. Returns the number of executed instructions.
+unsigned long Chip8::executeInstructions(unsigned long maxInstructions) {
+	unsigned long executed = 0;
 
-		advance(2);
-		return;
+	while (state.running && executed < maxInstructions) {
+		step();
+		executed++;
 	}
 
-	/*
-	7xkk - ADD Vx, byte
-	Set Vx = Vx + kk.
-	*/
-	if (optype == Chip8Opcodes::RegisterAdd) {
-		int reg = (opcode & 0x0F00) >> 8;
+	return executed;
+}
+
+//Runs one instruction and counts it for the timers, also when the machine is paused (F2)
+void Chip8::step() {
+	execute();
+	countInstructions(1);
+}
 
-		registers[reg] += byte2;
+/*
+	Timers.
+
+	Delay and sound timers tick 60 times per emulated second, i.e. every
+	cycles / 60 instructions, counted on the emulated instruction stream
+	rather than on a host clock. The remainder of the division is carried
+	the same way as in runFrame(), so a tick lands at the end of every frame.
+	Engines never run past instructionsUntilTick in one go and report what
+	they ran through countInstructions().
+*/
+void Chip8::countInstructions(unsigned long count) {
+	state.instructionsUntilTick -= count;
 
-		advance(2);
-		return;
+	//Below 60 instructions per second several ticks may fall on one instruction
+	while (state.instructionsUntilTick == 0) {
+		tickTimers();
+		scheduleTick();
 	}
+}
 
-	//Registers opcodes
-	if (optype == 0x8000) {
-		sf::Uint16 last = opcode & 0xF00F;
+void Chip8::scheduleTick() {
+	state.tickCredit += cycles;
 
-		auto regx = (opcode & 0x0F00) >> 8;
-		auto regy = (opcode & 0x00F0) >> 4;
+	state.instructionsUntilTick = state.tickCredit / CHIP8_CLOCK_SPEED;
+	state.tickCredit %= CHIP8_CLOCK_SPEED;
+}
 
-		/*
-		8xy0 - LD Vx, Vy
-		Set Vx = Vy.
-		*/
-		if (last == Chip8Opcodes::AssignRegisters) {
-			registers[regx] = registers[regy];
-			advance(2);
-			return;
-		}
+void Chip8::tickTimers() {
+	if (state.delayTimer > 0) {
+		state.delayTimer--;
+	}
 
-		/*
-		8xy1 - OR Vx, Vy
-		Set Vx = Vx OR Vy.
-		*/
-		if (last == Chip8Opcodes::BitwiseOr) {
-			registers[regx] = registers[regx] | registers[regy];
-			advance(2);
-			return;
-		}
+	if (state.soundTimer > 0) {
+		state.soundTimer--;
+	}
+}
 
-		/*
-		8xy2 - AND Vx, Vy
-		Set Vx = Vx AND Vy.
-		*/
-		if (last == Chip8Opcodes::BitwiseAnd) {
-			registers[regx] = registers[regx] & registers[regy];
-			advance(2);
-			return;
-		}
+/*
+	Idle loop detection.
+
+	ROMs wait for the delay timer or for nothing at all in two kinds of loops:
+	a 1nnn jumping to itself, and
+		Fx07 - LD Vx, DT
+		3x00 - SE Vx, 0
+		1nnn - JP back to the Fx07
+	No instruction inside them can change what the next iteration does, only
+	a timer tick or a key press can. Fx0A while no key is down is the same,
+	it runs again without changing anything. Callers pass the number of instructions
+	left until the next of those, and whole iterations are skipped instead of run,
+	leaving the machine in the state the loop would.
+
+	Returns the number of skipped instructions, 0 if pc is not at an idle loop.
+*/
+unsigned long Chip8::skipIdleLoop(unsigned long maxInstructions) {
+	if (state.pc + 1u >= CHIP8_MEMORY_SIZE) return 0;
 
+	const DecodedInstruction& first = decodedAt(state.pc);
 
-		/*
-		8xy3 - XOR Vx, Vy
-		Set Vx = Vx XOR Vy.
-		*/
-		if (last == Chip8Opcodes::BitwiseXor) {
-			registers[regx] = registers[regx] ^ registers[regy];
-			advance(2);
-			return;
-		}
+	if (first.handler == &Chip8::opJump) {
+		return first.nnn == state.pc ? maxInstructions : 0;
+	}
 
-		/*
-		8xy4 - ADD Vx, Vy
-		Set Vx = Vx + Vy, set VF = carry.
-		*/
-		if (last == Chip8Opcodes::AddRegisterAndSetCarry) {
-			if (registers[regx] + registers[regy] > 255) {
-				registers[CARRY_REGISTER] = 1;
-			} else {
-				registers[CARRY_REGISTER] = 0;
-			}
+	if (first.handler == &Chip8::opWaitKeyPress) {
+		return state.inputMask ? 0 : maxInstructions;
+	}
 
-			registers[regx] += registers[regy];
+	if (first.handler != &Chip8::opGetDelayTimerValue || state.delayTimer == 0 || state.pc + 5u >= CHIP8_MEMORY_SIZE) return 0;
 
-			advance(2);
-			return;
-		}
+	const DecodedInstruction& test = decodedAt(state.pc + 2);
+	const DecodedInstruction& jump = decodedAt(state.pc + 4);
 
-		/*
-		8xy5 - SUB Vx, Vy
-		Set Vx = Vx - Vy, set VF = NOT borrow.
+	if (test.handler != &Chip8::opSkipIfEqual || test.x != first.x || test.kk != 0) return 0;
+	if (jump.handler != &Chip8::opJump || jump.nnn != state.pc) return 0;
 
-		If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.
-		*/
-		if (last == Chip8Opcodes::SubtractRegisterAndSetCarry) {
-			if (registers[regx] > registers[regy]) {
-				registers[CARRY_REGISTER] = 1;
-			}
-			else {
-				registers[CARRY_REGISTER] = 0;
-			}
+	unsigned long iterations = maxInstructions / 3;
 
-			registers[regx] -= registers[regy];
+	if (iterations == 0) return 0;
 
-			advance(2);
-			return;
-		}
+	state.registers[first.x] = state.delayTimer;
 
-		/*
-		8xy6 - SHR Vx {, Vy}
-		Set Vx = Vx SHR 1.
+	return iterations * 3;
+}
 
-		If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.
-		*/
-		if (last == Chip8Opcodes::DivideLSB) {
-			registers[CARRY_REGISTER] = registers[regx] & 0x1;
-			registers[regx] = registers[regx] >> 1;
-			
-			advance(2);
-			return;
-		}
+/*
+	Skips idle loops back to back for up to maxInstructions, counting them for
+	the timers, until pc leaves them. For engines outside this file, the calls
+	inline here the way they do in executeBlocks().
 
-		/*
-		8xy7 - SUBN Vx, Vy
-		Set Vx = Vy - Vx, set VF = NOT borrow.
-
-		If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
-		*/
-		if (last == Chip8Opcodes::SubtractRegisterAndSetCarryYX) {
-			registers[regx] = registers[regy] - registers[regx];
-			
-			if (registers[regy] > registers[regx]) {
-				registers[CARRY_REGISTER] = 1;
-			} else {
-				registers[CARRY_REGISTER] = 0;
-			}
+	Returns the number of skipped instructions.
+*/
+unsigned long Chip8::skipIdleLoops(unsigned long maxInstructions) {
+	unsigned long skipped = 0;
 
-			advance(2);
-			return;
-		}
+	while (state.running && skipped < maxInstructions && state.pc < CHIP8_MEMORY_SIZE && cache->idleCandidates[state.pc]) {
+		unsigned long ran = skipIdleLoop(std::min<unsigned long>(maxInstructions - skipped, state.instructionsUntilTick));
 
-		/*
-		8xyE - SHL Vx {, Vy}
-		Set Vx = Vx SHL 1.
+		if (!ran) break;
 
-		If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.
-		*/
-		if (last == Chip8Opcodes::MultiplyMSB) {
-			registers[CARRY_REGISTER] = registers[regx] >> 7;
-			registers[regx] <<= 1;
+		skipped += ran;
+		countInstructions(ran);
+	}
 
-			advance(2);
-			return;
-		}
-		return;
+	return skipped;
+}
+
+//Runs the basic block at pc and returns the number of executed instructions
+unsigned int Chip8::runBlock(unsigned long maxInstructions) {
+	uint16_t length = state.pc < CHIP8_MEMORY_SIZE ? cache->blockLengths[state.pc] : 0;
+
+	if (!length && state.pc < CHIP8_MEMORY_SIZE) {
+		length = buildBlock(state.pc);
 	}
 
-	/*
-	9xy0 - SNE Vx, Vy
-	Skip next instruction if Vx != Vy.
+	//No complete instruction to build a block from, let execute() report it.
+	//A block longer than the budget is stepped through one instruction at a time.
+	if (!length || length > maxInstructions) {
+		execute();
+		return 1;
+	}
 
-	The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.
-	*/
-	if (optype == Chip8Opcodes::SkipIfRegistersNotEqual) {
-		auto regx = (opcode & 0x0F00) >> 8;
-		auto regy = (opcode & 0x00F0) >> 4;
+	for (uint16_t i = 0; i < length; i++) {
+#ifdef CHIP8_TRACE
+		//Traced one by one, so a fused pair shows as its two instructions
+		if (tracer) {
+			const uint16_t pc = state.pc;
+			const DecodedInstruction& ins = cache->decoded[pc];
 
-		if (registers[regx] != registers[regy]) {
-			advance(4);
-		} else {
-			advance(2);
+			(this->*ins.handler)(ins);
+			tracer->instruction(pc, ins.opcode, state);
+			continue;
 		}
+#endif
 
-		return;
+		const FusedHandler fused = cache->blockFusions[state.pc];
+
+		if (fused) {
+			(this->*fused)(cache->decoded[state.pc], cache->decoded[state.pc + 2]);
+			i++;
+			continue;
+		}
+
+		const DecodedInstruction& ins = cache->decoded[state.pc];
+		(this->*ins.handler)(ins);
 	}
 
-	/*
-	Annn - LD I, addr
-	Set I = nnn.
+	return length;
+}
 
-	The value of register I is set to nnn.
+uint16_t Chip8::buildBlock(unsigned int address) {
+	uint16_t length = 0;
+	unsigned int end = address;
 
-	*/
-	if (optype == Chip8Opcodes::SetIndexRegister) {
-		indexRegister = opcode & 0x0FFF;
-		advance(2);
-		return;
-	}
+	while (end + 1 < CHIP8_MEMORY_SIZE) {
+		const DecodedInstruction& ins = decodedAt(end);
 
+		length++;
+		end += 2;
 
-	/*
-	Bnnn - JP V0, addr
-	Jump to location nnn + V0.
+		if (ins.endsBlock) break;
+	}
 
-	The program counter is set to nnn plus the value of V0.
-	*/
-	if (optype == Chip8Opcodes::SetProgramCounterPlusV0) {
-		pc = (opcode & 0x0FFF) + registers[0];
-		return;
+	for (unsigned int i = address; i < end; i++) {
+		cache->blockCode[i] = true;
 	}
 
+	//Only the last instruction may end a block, so every other one is followed by its pair in the same block
+	for (unsigned int i = address; i < end; i += 2) {
+		cache->blockFusions[i] = i + 2 < end ? fuse(cache->decoded[i], cache->decoded[i + 2]) : nullptr;
 
-	/*
-	Cxkk - RND Vx, byte
-	Set Vx = random byte AND kk.
+#ifdef CHIP8_THREADED_DISPATCH
+		cache->blockOps[i] = threadedOp(cache->decoded[i].handler, cache->blockFusions[i]);
+#endif
+	}
 
-	The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk.
-	The results are stored in Vx. See instruction 8xy2 for more information on AND.
-	*/
-	if (optype == Chip8Opcodes::GenRandom) {
-		
-		int kk = opcode & 0x00FF;
+	const DecodedInstruction& first = cache->decoded[address];
+	cache->idleCandidates[address] = (first.handler == &Chip8::opJump && first.nnn == address) || first.handler == &Chip8::opGetDelayTimerValue || first.handler == &Chip8::opWaitKeyPress;
 
-		int regx = (opcode & 0x0F00) >> 8;
+	cache->blockLengths[address] = length;
 
-		registers[regx] = randNext() & kk;
-		advance(2);
+	return length;
+}
 
-		return;
+#ifdef CHIP8_THREADED_DISPATCH
+/*
+	Handlers and fused pairs run by runThreaded(), in the order of its labels.
+	The lists are expanded once into the tables below and once into the
+	labels, so they cannot get out of step.
+*/
+#define CHIP8_THREADED_HANDLERS(X) \
+	X(opClearScreen) X(opReturn) X(opJump) X(opSubroutineCall) \
+	X(opSkipIfEqual) X(opSkipIfNotEqual) X(opSkipIfRegistersEqual) X(opSetRegister) \
+	X(opRegisterAdd) X(opAssignRegisters) X(opBitwiseOr) X(opBitwiseAnd) \
+	X(opBitwiseXor) X(opAddRegisterAndSetCarry) X(opSubtractRegisterAndSetCarry) X(opDivideLSB) \
+	X(opSubtractRegisterAndSetCarryYX) X(opMultiplyMSB) X(opSkipIfRegistersNotEqual) X(opSetIndexRegister) \
+	X(opSetProgramCounterPlusV0) X(opGenRandom) X(opDrawSprite) X(opSkipIfKeyIsPressed) \
+	X(opSkipIfKeyIsNotPressed) X(opGetDelayTimerValue) X(opWaitKeyPress) X(opSetDelayTimer) \
+	X(opSetSoundTimer) X(opIndexAdd) X(opIndexSetFont) X(opIndexBCD) \
+	X(opRegistersToMemory) X(opMemoryToRegisters) X(unknownOpcode)
+
+#define CHIP8_THREADED_FUSIONS(X) \
+	X(fuseIndexDraw) X(fuseLoadLoad) X(fuseAddSkipIfEqual) X(fuseAddSkipIfNotEqual) X(fuseIndexLoad)
+
+#define CHIP8_HANDLER_POINTER(name) &Chip8::name,
+
+const Chip8::OpcodeHandler Chip8::threadedHandlers[] = { CHIP8_THREADED_HANDLERS(CHIP8_HANDLER_POINTER) };
+const Chip8::FusedHandler Chip8::threadedFusions[] = { CHIP8_THREADED_FUSIONS(CHIP8_HANDLER_POINTER) };
+
+//Label of an instruction, or of the pair it starts if fused
+uint8_t Chip8::threadedOp(OpcodeHandler handler, FusedHandler fused) {
+	const uint8_t handlerCount = sizeof(threadedHandlers) / sizeof(threadedHandlers[0]);
+	const uint8_t fusionCount = sizeof(threadedFusions) / sizeof(threadedFusions[0]);
+
+	for (uint8_t i = 0; fused && i < fusionCount; i++) {
+		if (threadedFusions[i] == fused) return handlerCount + i;
 	}
 
-	/*
-	Dxyn - DRW Vx, Vy, nibble
-	Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
+	for (uint8_t i = 0; i < handlerCount; i++) {
+		if (threadedHandlers[i] == handler) return i;
+	}
 
-	The interpreter reads n bytes from memory, starting at the address stored in I. 
-	These bytes are then displayed as sprites on screen at coordinates (Vx, Vy). 
-	Sprites are XORed onto the existing screen. 
-	If this causes any pixels to be erased, VF is set to 1, otherwise it is set to 0. 
-	If the sprite is positioned so part of it is outside the coordinates of the display, 
-	it wraps around to the opposite side of the screen. 
-	*/
+	return handlerCount - 1; //unknownOpcode
+}
 
-	if (optype == Chip8Opcodes::DrawSprite) {
-		auto n = opcode & 0x000F;
-		auto regx = (opcode & 0x0F00) >> 8;
-		auto regy = (opcode & 0x00F0) >> 4;
+/*
+	Threaded block engine.
 
-		auto x = registers[regx];
-		auto y = registers[regy];
+	Runs whole blocks back to back until the next one does not fit into
+	maxInstructions or starts an idle loop, which executeBlocks() skips.
+	Every handler is a label, jumped to through a table indexed by blockOps,
+	so the handlers are inlined and each has its own indirect jump to the
+	next one instead of a shared call site. The effects and the instruction
+	count are the same as running runBlock() on each block.
 
-		for (int i = 0; i < n; ++i) {
-			sf::Uint8 a = memory[indexRegister + i];
+	Returns the number of executed instructions, 0 if the block at pc does
+	not fit or is not built.
+*/
+unsigned long Chip8::runThreaded(unsigned long maxInstructions) {
+#define CHIP8_LABEL_ADDRESS(name) &&run_##name,
 
-			for (int col = 0; col < 8; ++col) {
-				bool bitValue = a & (0x80 >> col);
+	static void* const labels[] = {
+		CHIP8_THREADED_HANDLERS(CHIP8_LABEL_ADDRESS)
+		CHIP8_THREADED_FUSIONS(CHIP8_LABEL_ADDRESS)
+	};
 
-				int sx = (x + col) % CHIP8_SCREEN_WIDTH;
-				int sy = (y + i) % CHIP8_SCREEN_HEIGHT;
+	CodeCache& code = *cache;
+	unsigned long executed = 0;
+	unsigned int left = 0; //instructions left in the current block
+	const DecodedInstruction* ins = nullptr;
 
-				if (screen[sx][sy] == 1) registers[CARRY_REGISTER] = 1;
+#define CHIP8_DISPATCH() \
+	if (!left) goto nextBlock; \
+	ins = &code.decoded[state.pc]; \
+	goto *labels[code.blockOps[state.pc]]
 
-				if (bitValue) {
-					screen[sx][sy] = screen[sx][sy] ^ 1;
-				}
-			}
-		}
-		advance(2);
-		return;
+nextBlock:
+	if (!state.running || state.pc >= CHIP8_MEMORY_SIZE) return executed;
+
+	//Only the first block is run if it is an idle loop, executeBlocks() already found it could not skip it
+	if (executed && code.idleCandidates[state.pc]) return executed;
+
+	left = code.blockLengths[state.pc];
+
+	if (!left) {
+		left = buildBlock(state.pc);
 	}
 
-	/*
-	Ex9E - SKP Vx
-	Skip next instruction if key with the value of Vx is pressed.
+	if (!left || left > maxInstructions - executed) return executed;
 
-	Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position, 
-	PC is increased by 2.
-	*/
-	if ((opcode & 0xF0FF) == Chip8Opcodes::SkipIfKeyIsPressed) {
-		auto reg = (opcode & 0x0F00) >> 8;
+	executed += left;
 
-		if ((inputMask & (1 << registers[reg])) != 0) {
-			advance(4);
-		} else {
-			advance(2);
-		}
-		return;
+	CHIP8_DISPATCH();
+
+#define CHIP8_RUN_HANDLER(name) \
+run_##name: \
+	name(*ins); \
+	left--; \
+	CHIP8_DISPATCH();
+
+#define CHIP8_RUN_FUSION(name) \
+run_##name: \
+	name(*ins, code.decoded[state.pc + 2]); \
+	left -= 2; \
+	CHIP8_DISPATCH();
+
+	CHIP8_THREADED_HANDLERS(CHIP8_RUN_HANDLER)
+	CHIP8_THREADED_FUSIONS(CHIP8_RUN_FUSION)
+
+#undef CHIP8_RUN_FUSION
+#undef CHIP8_RUN_HANDLER
+#undef CHIP8_DISPATCH
+#undef CHIP8_LABEL_ADDRESS
+}
+
+#undef CHIP8_HANDLER_POINTER
+#undef CHIP8_THREADED_FUSIONS
+#undef CHIP8_THREADED_HANDLERS
+#endif
+
+/*
+	Superinstructions.
+
+	Frequent instruction pairs get a handler that runs both with a single
+	dispatch and exactly the same effects as running them one by one.
+	A pair is only fused inside a built block, execute() and the debugger
+	still step through single instructions.
+*/
+Chip8::FusedHandler Chip8::fuse(const DecodedInstruction& first, const DecodedInstruction& second) {
+	if (first.handler == &Chip8::opSetIndexRegister && second.handler == &Chip8::opDrawSprite) {
+		return &Chip8::fuseIndexDraw;
 	}
 
-	/*
-	ExA1 - SKNP Vx
-	Skip next instruction if key with the value of Vx is not pressed.
+	if (first.handler == &Chip8::opSetRegister && second.handler == &Chip8::opSetRegister) {
+		return &Chip8::fuseLoadLoad;
+	}
 
-	Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2.
-	*/
+	if (first.handler == &Chip8::opRegisterAdd && second.handler == &Chip8::opSkipIfEqual) {
+		return &Chip8::fuseAddSkipIfEqual;
+	}
 
-	if ((opcode & 0xF0FF) == Chip8Opcodes::SkipIfKeyIsNotPressed) {
-		auto reg = (opcode & 0x0F00) >> 8;
+	if (first.handler == &Chip8::opRegisterAdd && second.handler == &Chip8::opSkipIfNotEqual) {
+		return &Chip8::fuseAddSkipIfNotEqual;
+	}
 
-		if ((inputMask & (1 << registers[reg])) == 0) {
-			advance(4);
-		}
-		else {
-			advance(2);
-		}
-		return;
+	if (first.handler == &Chip8::opIndexAdd && second.handler == &Chip8::opMemoryToRegisters) {
+		return &Chip8::fuseIndexLoad;
 	}
 
-	/*
-	Fx07 - LD Vx, DT
-	Set Vx = delay timer value.
+	return nullptr;
+}
 
-	The value of DT is placed into Vx.
-	*/
+//Annn, Dxyn
+void Chip8::fuseIndexDraw(const DecodedInstruction& first, const DecodedInstruction& second) {
+	state.indexRegister = first.nnn;
+	state.pc += 2;
 
-	if ((opcode & 0xF0FF) == Chip8Opcodes::GetDelayTimerValue) {
-		auto reg = (opcode & 0x0F00) >> 8;
+	opDrawSprite(second);
 
-		registers[reg] = delayTimer;
-		advance(2);
-		return;
+	fusionCounts[FUSION_INDEX_DRAW]++;
+}
+
+//6xkk, 6xkk
+void Chip8::fuseLoadLoad(const DecodedInstruction& first, const DecodedInstruction& second) {
+	state.registers[first.x] = first.kk;
+	state.registers[second.x] = second.kk;
+
+	advance(4);
+
+	fusionCounts[FUSION_LOAD_LOAD]++;
+}
+
+//7xkk, 3xkk
+void Chip8::fuseAddSkipIfEqual(const DecodedInstruction& first, const DecodedInstruction& second) {
+	state.registers[first.x] += first.kk;
+
+	advance(state.registers[second.x] == second.kk ? 6 : 4);
+
+	fusionCounts[FUSION_ADD_SKIP]++;
+}
+
+//7xkk, 4xkk
+void Chip8::fuseAddSkipIfNotEqual(const DecodedInstruction& first, const DecodedInstruction& second) {
+	state.registers[first.x] += first.kk;
+
+	advance(state.registers[second.x] != second.kk ? 6 : 4);
+
+	fusionCounts[FUSION_ADD_SKIP]++;
+}
+
+//Fx1E, Fx65
+void Chip8::fuseIndexLoad(const DecodedInstruction& first, const DecodedInstruction& second) {
+	state.indexRegister = state.indexRegister + state.registers[first.x];
+
+	for (int i = 0; i <= second.x; i++) {
+		state.registers[i] = state.memory[(state.indexRegister + i) & 0x0FFF];
 	}
 
-	/*
-	Fx0A - LD Vx, K
-	Wait for a key press, store the value of the key in Vx.
+	advance(4);
 
-	All execution stops until a key is pressed, then the value of that key is stored in Vx.
-	*/
+	fusionCounts[FUSION_INDEX_LOAD]++;
+}
 
-	if ((opcode & 0xF0FF) == Chip8Opcodes::WaitKeyPress) {
-		auto reg = (opcode & 0x0F00) >> 8;
+unsigned long Chip8::getFusionCount(Chip8Fusion fusion) const {
+	return fusionCounts[fusion];
+}
 
-		for (auto i = 0; i < CHIP8_KBD_SIZE; ++i) {
-			if (inputMask & (1 << i)) {
-				registers[reg] = i;
-				advance(2);
-				return;
-			}
-		}
+void Chip8::clearBlocks() {
+	cache->blockLengths.fill(0);
+	cache->blockCode.reset();
+	cache->idleCandidates.reset();
 
-		return;
+	if (codeListener) {
+		codeListener->flush();
 	}
+}
 
-	/*
-	Fx15 - LD DT, Vx
-	Set delay timer = Vx.
+/*
+00E0 - CLS
+Clear the display.
+*/
+void Chip8::opClearScreen(const DecodedInstruction& /*ins*/) {
+	clearScreen();
+	advance(2);
+}
 
-	DT is set equal to the value of Vx.
-	*/
-	if ((opcode & 0xF0FF) == Chip8Opcodes::SetDelayTimer) {
-		auto reg = (opcode & 0x0F00) >> 8;
+/*
+00EE - RET
+Return from a subroutine.
+*/
+void Chip8::opReturn(const DecodedInstruction& /*ins*/) {
+	state.pc = pop();
+	advance(2);
+}
 
-		delayTimer = registers[reg];
-		advance(2);
+/*
+1nnn - JP addr
+Jump to location nnn.
+*/
+void Chip8::opJump(const DecodedInstruction& ins) {
+	state.pc = ins.nnn;
+}
 
-		return;
+/*
+2nnn - CALL addr
+Call subroutine at nnn.
+*/
+void Chip8::opSubroutineCall(const DecodedInstruction& ins) {
+	push(state.pc);
+
+	state.pc = ins.nnn;
+}
+
+/*
+3xkk - SE Vx, byte
+Skip next instruction if Vx = kk.
+*/
+void Chip8::opSkipIfEqual(const DecodedInstruction& ins) {
+	if (state.registers[ins.x] == ins.kk) {
+		advance(4);
+	} else {
+		advance(2);
 	}
+}
 
-	/*
-	Fx18 - LD ST, Vx
-	Set sound timer = Vx.
+/*
+4xkk - SNE Vx, byte
+Skip next instruction if Vx != kk.
+*/
+void Chip8::opSkipIfNotEqual(const DecodedInstruction& ins) {
+	if (state.registers[ins.x] != ins.kk) {
+		advance(4);
+	}
+	else {
+		advance(2);
+	}
+}
 
-	ST is set equal to the value of Vx.
-	*/
-	if ((opcode & 0xF0FF) == Chip8Opcodes::SetSoundTimer) {
-		auto reg = (opcode & 0x0F00) >> 8;
+/*
+5xy0 - SE Vx, Vy
+Skip next instruction if Vx = Vy.
+*/
+void Chip8::opSkipIfRegistersEqual(const DecodedInstruction& ins) {
+	auto reg1 = ins.x;
+	auto reg2 = ins.y;
 
-		soundTimer = registers[reg];
+	if (state.registers[reg1] == state.registers[reg2]) {
+		advance(4);
+	} else {
 		advance(2);
+	}
+}
 
-		return;
+/*
+6xkk - LD Vx, byte
+Set Vx = kk.
+*/
+void Chip8::opSetRegister(const DecodedInstruction& ins) {
+	int reg = ins.x;
+
+	state.registers[reg] = ins.kk;
+
+	advance(2);
+}
+
+/*
+7xkk - ADD Vx, byte
+Set Vx = Vx + kk.
+*/
+void Chip8::opRegisterAdd(const DecodedInstruction& ins) {
+	int reg = ins.x;
+
+	state.registers[reg] += ins.kk;
+
+	advance(2);
+}
+
+/*
+8xy0 - LD Vx, Vy
+Set Vx = Vy.
+*/
+void Chip8::opAssignRegisters(const DecodedInstruction& ins) {
+	auto regx = ins.x;
+	auto regy = ins.y;
+
+	state.registers[regx] = state.registers[regy];
+	advance(2);
+}
+
+/*
+8xy1 - OR Vx, Vy
+Set Vx = Vx OR Vy.
+*/
+void Chip8::opBitwiseOr(const DecodedInstruction& ins) {
+	auto regx = ins.x;
+	auto regy = ins.y;
+
+	state.registers[regx] = state.registers[regx] | state.registers[regy];
+	advance(2);
+}
+
+/*
+8xy2 - AND Vx, Vy
+Set Vx = Vx AND Vy.
+*/
+void Chip8::opBitwiseAnd(const DecodedInstruction& ins) {
+	auto regx = ins.x;
+	auto regy = ins.y;
+
+	state.registers[regx] = state.registers[regx] & state.registers[regy];
+	advance(2);
+}
+
+/*
+8xy3 - XOR Vx, Vy
+Set Vx = Vx XOR Vy.
+*/
+void Chip8::opBitwiseXor(const DecodedInstruction& ins) {
+	auto regx = ins.x;
+	auto regy = ins.y;
+
+	state.registers[regx] = state.registers[regx] ^ state.registers[regy];
+	advance(2);
+}
+
+/*
+8xy4 - ADD Vx, Vy
+Set Vx = Vx + Vy, set VF = carry.
+*/
+void Chip8::opAddRegisterAndSetCarry(const DecodedInstruction& ins) {
+	auto regx = ins.x;
+	auto regy = ins.y;
+
+	if (state.registers[regx] + state.registers[regy] > 255) {
+		state.registers[CARRY_REGISTER] = 1;
+	} else {
+		state.registers[CARRY_REGISTER] = 0;
 	}
 
-	/*
-	Fx1E - ADD I, Vx
-	Set I = I + Vx.
+	state.registers[regx] += state.registers[regy];
 
-	The values of I and Vx are added, and the results are stored in I.
-	*/
-	if ((opcode & 0xF0FF) == Chip8Opcodes::IndexAdd) {
-		auto reg = (opcode & 0x0F00) >> 8;
+	advance(2);
+}
 
-		indexRegister = indexRegister + registers[reg];
-		advance(2);
+/*
+8xy5 - SUB Vx, Vy
+Set Vx = Vx - Vy, set VF = NOT borrow.
 
-		return;
+If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.
+*/
+void Chip8::opSubtractRegisterAndSetCarry(const DecodedInstruction& ins) {
+	auto regx = ins.x;
+	auto regy = ins.y;
+
+	if (state.registers[regx] > state.registers[regy]) {
+		state.registers[CARRY_REGISTER] = 1;
+	}
+	else {
+		state.registers[CARRY_REGISTER] = 0;
 	}
 
-	/*
-	Fx29 - LD F, Vx
-	Set I = location of sprite for digit Vx.
+	state.registers[regx] -= state.registers[regy];
 
-	The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx.
-	*/
-	if ((opcode & 0xF0FF) == Chip8Opcodes::IndexSetFont) {
-		auto reg = (opcode & 0x0F00) >> 8;
+	advance(2);
+}
 
-		indexRegister = registers[reg] * 0x5;
-		advance(2);
+/*
+8xy6 - SHR Vx {, Vy}
+Set Vx = Vx SHR 1.
 
-		return;
+If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.
+*/
+void Chip8::opDivideLSB(const DecodedInstruction& ins) {
+	auto regx = ins.x;
+
+	state.registers[CARRY_REGISTER] = state.registers[regx] & 0x1;
+	state.registers[regx] = state.registers[regx] >> 1;
+
+	advance(2);
+}
+
+/*
+8xy7 - SUBN Vx, Vy
+Set Vx = Vy - Vx, set VF = NOT borrow.
+
+If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
+*/
+void Chip8::opSubtractRegisterAndSetCarryYX(const DecodedInstruction& ins) {
+	auto regx = ins.x;
+	auto regy = ins.y;
+
+	state.registers[regx] = state.registers[regy] - state.registers[regx];
+
+	if (state.registers[regy] > state.registers[regx]) {
+		state.registers[CARRY_REGISTER] = 1;
+	} else {
+		state.registers[CARRY_REGISTER] = 0;
 	}
 
-	/*
-	Fx33 - LD B, Vx
-	Store BCD representation of Vx in memory locations I, I+1, and I+2.
+	advance(2);
+}
+
+/*
+8xyE - SHL Vx {, Vy}
+Set Vx = Vx SHL 1.
+
+If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.
+*/
+void Chip8::opMultiplyMSB(const DecodedInstruction& ins) {
+	auto regx = ins.x;
 
-	The interpreter takes the decimal value of Vx, 
-	and places the hundreds digit in memory at location in I, 
-	the tens digit at location I+1, 
-	and the ones digit at location I+2.
-	*/
-	if ((opcode & 0xF0FF) == Chip8Opcodes::IndexBCD) {
-		auto reg = (opcode & 0x0F00) >> 8;
+	state.registers[CARRY_REGISTER] = state.registers[regx] >> 7;
+	state.registers[regx] <<= 1;
 
-		auto val = registers[reg];
+	advance(2);
+}
 
-		auto hunderds = val / 100;
-		auto tens = (val / 10) % 10;
-		auto ones = (val % 100) % 10;
+/*
+9xy0 - SNE Vx, Vy
+Skip next instruction if Vx != Vy.
 
-		memory[indexRegister] = hunderds;
-		memory[indexRegister + 1] = tens;
-		memory[indexRegister + 2] = ones;
+The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.
+*/
+void Chip8::opSkipIfRegistersNotEqual(const DecodedInstruction& ins) {
+	auto regx = ins.x;
+	auto regy = ins.y;
 
+	if (state.registers[regx] != state.registers[regy]) {
+		advance(4);
+	} else {
 		advance(2);
-		return;
 	}
+}
 
-	/*
-	Fx55 - LD [I], Vx
-	Store registers V0 through Vx in memory starting at location I.
+/*
+Annn - LD I, addr
+Set I = nnn.
+
+The value of register I is set to nnn.
+*/
+void Chip8::opSetIndexRegister(const DecodedInstruction& ins) {
+	state.indexRegister = ins.nnn;
+	advance(2);
+}
 
-	The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.
-	*/
-	if ((opcode & 0xF0FF) == Chip8Opcodes::RegistersToMemory) {
-		auto x = (opcode & 0x0F00) >> 8;
+/*
+Bnnn - JP V0, addr
+Jump to location nnn + V0.
+
+The program counter is set to nnn plus the value of V0.
+*/
+void Chip8::opSetProgramCounterPlusV0(const DecodedInstruction& ins) {
+	state.pc = ins.nnn + state.registers[0];
+}
 
-		for (int i = 0; i <= x; i++) {
-			memory[indexRegister + i] = registers[i];
+/*
+Cxkk - RND Vx, byte
+Set Vx = random byte AND kk.
+
+The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk.
+The results are stored in Vx. See instruction 8xy2 for more information on AND.
+*/
+void Chip8::opGenRandom(const DecodedInstruction& ins) {
+	int kk = ins.kk;
+
+	int regx = ins.x;
+
+	state.registers[regx] = chip8NextRandom(state.randomState) & kk;
+	advance(2);
+}
+
+/*
+Dxyn - DRW Vx, Vy, nibble
+Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
+
+The interpreter reads n bytes from memory, starting at the address stored in I.
+These bytes are then displayed as sprites on screen at coordinates (Vx, Vy).
+Sprites are XORed onto the existing screen.
+If this causes any pixels to be erased, VF is set to 1, otherwise it is set to 0.
+If the sprite is positioned so part of it is outside the coordinates of the display,
+it wraps around to the opposite side of the screen.
+*/
+void Chip8::opDrawSprite(const DecodedInstruction& ins) {
+	auto n = ins.n;
+
+	unsigned int x = state.registers[ins.x] % CHIP8_SCREEN_WIDTH;
+	unsigned int y = state.registers[ins.y];
+
+	bool erased = false;
+
+	for (int i = 0; i < n; ++i) {
+		//Sprite row moved to column x of a screen row, rotating wraps it around the right edge
+		uint64_t sprite = static_cast<uint64_t>(state.memory[(state.indexRegister + i) & 0x0FFF]) << (CHIP8_SCREEN_WIDTH - 8);
+
+		if (x) {
+			sprite = sprite >> x | sprite << (CHIP8_SCREEN_WIDTH - x);
 		}
 
-		advance(2);
-		return;
+		uint64_t& row = state.screen[(y + i) % CHIP8_SCREEN_HEIGHT];
+
+		if (row & sprite) erased = true;
+
+		row ^= sprite;
+
+		if (sprite) dirtyRows |= 1u << ((y + i) % CHIP8_SCREEN_HEIGHT);
 	}
 
-	/*
-	Fx65 - LD Vx, [I]
-	Read registers V0 through Vx from memory starting at location I.
+	state.registers[CARRY_REGISTER] = erased ? 1 : 0;
+
+	advance(2);
+}
 
-	The interpreter reads values from memory starting at location I into registers V0 through Vx.
-	*/
-	if ((opcode & 0xF0FF) == Chip8Opcodes::MemoryToRegisters) {
-		auto x = (opcode & 0x0F00) >> 8;
+/*
+Ex9E - SKP Vx
+Skip next instruction if key with the value of Vx is pressed.
 
-		for (int i = 0; i <= x; i++) {
-			registers[i] = memory[indexRegister + i];
-		}
+Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position,
+PC is increased by 2.
+*/
+void Chip8::opSkipIfKeyIsPressed(const DecodedInstruction& ins) {
+	auto reg = ins.x;
 
+	if ((state.inputMask & (1 << (state.registers[reg] & 0xF))) != 0) {
+		advance(4);
+	} else {
 		advance(2);
-		return;
 	}
+}
+
+/*
+ExA1 - SKNP Vx
+Skip next instruction if key with the value of Vx is not pressed.
 
-	unknownOpcode(opcode);
-	return;
+Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2.
+*/
+void Chip8::opSkipIfKeyIsNotPressed(const DecodedInstruction& ins) {
+	auto reg = ins.x;
+
+	if ((state.inputMask & (1 << (state.registers[reg] & 0xF))) == 0) {
+		advance(4);
+	}
+	else {
+		advance(2);
+	}
 }
 
-void Chip8::update() {
-	if (!running) return;
+/*
+Fx07 - LD Vx, DT
+Set Vx = delay timer value.
 
-	execute();
-	updateDebugText();
+The value of DT is placed into Vx.
+*/
+void Chip8::opGetDelayTimerValue(const DecodedInstruction& ins) {
+	auto reg = ins.x;
+
+	state.registers[reg] = state.delayTimer;
+	advance(2);
+}
+
+/*
+Fx0A - LD Vx, K
+Wait for a key press, store the value of the key in Vx.
 
-	if (delayTimer > 0) {
-		if (delayClock.getElapsedTime().asMilliseconds() > 1000 / CHIP8_CLOCK_SPEED) {
-			delayTimer--;
-			delayClock.restart();
+All execution stops until a key is pressed, then the value of that key is stored in Vx.
+*/
+void Chip8::opWaitKeyPress(const DecodedInstruction& ins) {
+	auto reg = ins.x;
+
+	//Waiting is the common case, it runs again and again until a key goes down
+	if (!state.inputMask) return;
+
+	for (unsigned int i = 0; i < CHIP8_KBD_SIZE; ++i) {
+		if (state.inputMask & (1 << i)) {
+			state.registers[reg] = i;
+			advance(2);
+			return;
 		}
 	}
 }
 
+/*
+Fx15 - LD DT, Vx
+Set delay timer = Vx.
+
+DT is set equal to the value of Vx.
+*/
+void Chip8::opSetDelayTimer(const DecodedInstruction& ins) {
+	auto reg = ins.x;
+
+	state.delayTimer = state.registers[reg];
+	advance(2);
+}
+
+/*
+Fx18 - LD ST, Vx
+Set sound timer = Vx.
+
+ST is set equal to the value of Vx.
+*/
+void Chip8::opSetSoundTimer(const DecodedInstruction& ins) {
+	auto reg = ins.x;
+
+	state.soundTimer = state.registers[reg];
+	advance(2);
+}
+
+/*
+Fx1E - ADD I, Vx
+Set I = I + Vx.
+
+The values of I and Vx are added, and the results are stored in I.
+*/
+void Chip8::opIndexAdd(const DecodedInstruction& ins) {
+	auto reg = ins.x;
+
+	state.indexRegister = state.indexRegister + state.registers[reg];
+	advance(2);
+}
+
+/*
+Fx29 - LD F, Vx
+Set I = location of sprite for digit Vx.
+
+The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx.
+*/
+void Chip8::opIndexSetFont(const DecodedInstruction& ins) {
+	auto reg = ins.x;
+
+	state.indexRegister = state.registers[reg] * 0x5;
+	advance(2);
+}
+
+/*
+Fx33 - LD B, Vx
+Store BCD representation of Vx in memory locations I, I+1, and I+2.
+
+The interpreter takes the decimal value of Vx,
+and places the hundreds digit in memory at location in I,
+the tens digit at location I+1,
+and the ones digit at location I+2.
+*/
+void Chip8::opIndexBCD(const DecodedInstruction& ins) {
+	auto reg = ins.x;
+
+	auto val = state.registers[reg];
+
+	auto hunderds = val / 100;
+	auto tens = (val / 10) % 10;
+	auto ones = (val % 100) % 10;
+
+	writeMemory(state.indexRegister, hunderds);
+	writeMemory(state.indexRegister + 1, tens);
+	writeMemory(state.indexRegister + 2, ones);
+
+	advance(2);
+}
+
+/*
+Fx55 - LD [I], Vx
+Store registers V0 through Vx in memory starting at location I.
+
+The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.
+*/
+void Chip8::opRegistersToMemory(const DecodedInstruction& ins) {
+	auto x = ins.x;
+
+	for (int i = 0; i <= x; i++) {
+		writeMemory(state.indexRegister + i, state.registers[i]);
+	}
+
+	advance(2);
+}
+
+/*
+Fx65 - LD Vx, [I]
+Read registers V0 through Vx from memory starting at location I.
+
+The interpreter reads values from memory starting at location I into registers V0 through Vx.
+*/
+void Chip8::opMemoryToRegisters(const DecodedInstruction& ins) {
+	auto x = ins.x;
+
+	for (int i = 0; i <= x; i++) {
+		state.registers[i] = state.memory[(state.indexRegister + i) & 0x0FFF];
+	}
+
+	advance(2);
+}
+
+/*
+	Runs one emulated frame of cycles / 60 instructions, ending with a timer tick.
+	The remainder of the division is carried over to the following frames,
+	so the average speed matches cycles exactly.
+	Returns the number of executed instructions.
+*/
+unsigned long Chip8::runFrame() {
+	state.instructionCredit += cycles;
+
+	unsigned long budget = state.instructionCredit / CHIP8_CLOCK_SPEED;
+	state.instructionCredit %= CHIP8_CLOCK_SPEED;
+
+	return executeBlocks(budget);
+}
+
 void Chip8::printData() {
 	std::cout << std::hex;
 	for (std::size_t i = 0; i < data.size(); i++) {
@@ -695,110 +1329,286 @@ void Chip8::printData() {
 
 void Chip8::printMemory() {
 	std::cout << std::hex;
-	for (std::size_t i = 0; i < memory.size(); i += 2) {
-		std::cout << (int) memory[i] << " ";
+	for (std::size_t i = 0; i < state.memory.size(); i += 2) {
+		std::cout << (int) state.memory[i] << " ";
 	}
 }
 
+bool Chip8::hasSameState(const Chip8& other) const {
+	return state.pc == other.state.pc
+		&& state.sp == other.state.sp
+		&& state.indexRegister == other.state.indexRegister
+		&& state.delayTimer == other.state.delayTimer
+		&& state.instructionsUntilTick == other.state.instructionsUntilTick
+		&& state.soundTimer == other.state.soundTimer
+		&& state.randomState == other.state.randomState
+		&& state.running == other.state.running
+		&& state.registers == other.state.registers
+		&& state.stack == other.state.stack
+		&& state.memory == other.state.memory
+		&& state.screen == other.state.screen;
+}
+
 void Chip8::setRunning(bool arg) {
-	running = arg;
+	state.running = arg;
 }
 
 bool Chip8::isRunning() {
-	return running;
+	return state.running;
 }
 
-void Chip8::updateDebugText() {
-	Opcode oc = memory[pc] << 8 | memory[pc + 1];
+bool Chip8::isHalted() const {
+	if (!state.running) return true;
+	if (state.pc + 1u >= CHIP8_MEMORY_SIZE) return false;
 
-	std::stringstream sstream;
+	unsigned int opcode = state.memory[state.pc] << 8 | state.memory[state.pc + 1];
 
-	sstream << "Program counter: " << pc << std::hex << " (0x" << pc << ")" << std::dec << " Stack pointer: " << sp << " Index register: " << indexRegister 
-		<< " Input mask: " << std::bitset<16>(inputMask) << " Next opcode: " << std::hex << oc << "\n";
-	sstream << "Registers: ";
-
-	for (int r = 0; r < CHIP8_REGISTERS; r++) {
-		sstream << "V" << r << "=" << std::hex << registers[r] << " ";
-
-		if (r == 8) sstream << "\n";
-	}
+	return opcode == (Chip8Opcodes::Jump | state.pc);
+}
 
-	sstream << "\nStack:\n";
-	for (int i = 0; i < stack.size(); i++) {
-		if (stack[i] != 0x0) sstream << std::hex << "0x" << stack[i] << "\n";
+void Chip8::pressKey(unsigned int key) {
+	if (key < CHIP8_KBD_SIZE) {
+		state.inputMask |= (1 << key);
 	}
-
-	debugText.setString(sstream.str());
-	debugText.setPosition(10, window->getSize().y - debugText.getGlobalBounds().height - 15);
 }
 
-void Chip8::processKeyPress(sf::Event & ev) {
-	for (int i = 0; i < CHIP8_KBD_SIZE; i++) {
-		if (ev.key.code == kbdmap[i]) {
-			inputMask |= (1 << i);
-			return;
-		}
+void Chip8::releaseKey(unsigned int key) {
+	if (key < CHIP8_KBD_SIZE) {
+		state.inputMask &= ~(1 << key);
 	}
 }
 
-void Chip8::processKeyRelease(sf::Event & ev) {
-	for (int i = 0; i < CHIP8_KBD_SIZE; i++) {
-		if (ev.key.code == kbdmap[i]) {
-			inputMask &= ~(1 << i);
-			return;
-		}
-	}
+void Chip8::setKeys(uint16_t keys) {
+	state.inputMask = keys;
 }
 
 void Chip8::setCycles(int perSecond) {
 	if (perSecond <= 0) {
-		running = false;
-		error = true;
-		errText.setString("Manual mode. Press F2 for next opcode");
+		fail("Manual mode. Press F2 for next opcode");
 		return;
 	}
 
 	cycles = perSecond;
 }
 
-int Chip8::getCycles() {
+int Chip8::getCycles() const {
 	return cycles;
 }
 
+#ifdef CHIP8_TRACE
+void Chip8::setTracer(Chip8Tracer* tracer) {
+	this->tracer = tracer;
+}
+#endif
+
+uint64_t Chip8::getRomHash() const {
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	for (uint8_t byte : data) {
+		hash ^= byte;
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+/*
+	Everything after the memory is only a few hundred bytes (screen, stack,
+	registers, timers, keys, random generator), and the JIT and static
+	engines write registers without going through the core, so that part is
+	mixed in word by word on every call. Only the memory is tracked on write.
+*/
+uint64_t Chip8::getStateHash() const {
+	static_assert(offsetof(Chip8State, screen) == CHIP8_MEMORY_SIZE, "memory must come first in Chip8State");
+	static_assert((sizeof(Chip8State) - CHIP8_MEMORY_SIZE) % sizeof(uint64_t) == 0, "Chip8State must end on a word");
+
+	const uint8_t* rest = reinterpret_cast<const uint8_t*>(&state) + CHIP8_MEMORY_SIZE;
+	uint64_t hash = memoryHash;
+
+	for (std::size_t i = 0; i < sizeof(Chip8State) - CHIP8_MEMORY_SIZE; i += sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, rest + i, sizeof(word));
+
+		hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+		hash ^= hash >> 32;
+	}
+
+	return hash;
+}
+
+void Chip8::seedRandom(uint64_t seed) {
+	state.randomState = chip8SeedRandom(seed);
+}
+
 void Chip8::advance(int a) {
-	pc += a;
+	state.pc += a;
 
-	if (pc >= memory.size()) {
-		errText.setString("Out of memory.");
-		running = false;
+	if (state.pc >= state.memory.size()) {
+		fail("Out of memory.");
 		return;
 	}
 }
 
-void Chip8::push(sf::Uint16 value) {
-	stack[sp++] = value;
-}
+void Chip8::push(uint16_t value) {
+	if (state.sp >= CHIP8_STACK_SIZE) {
+		fail("Stack overflow.");
+		return;
+	}
 
-sf::Uint16 Chip8::pop() {
-	return stack[--sp];
+	state.stack[state.sp++] = value;
 }
 
-void Chip8::unknownOpcode(sf::Uint16 opcode) {
-	setRunning(false);
+uint16_t Chip8::pop() {
+	if (state.sp == 0) {
+		fail("Stack underflow.");
+		return state.pc;
+	}
 
-	error = true;
+	return state.stack[--state.sp];
+}
 
+void Chip8::unknownOpcode(const DecodedInstruction& ins) {
 	std::stringstream ss;
 
-	ss << "Unknown opcode: 0x" << std::hex << std::uppercase << opcode << "\n";
+	ss << "Unknown opcode: 0x" << std::hex << std::uppercase << ins.opcode << "\n";
+
+	fail(ss.str());
+}
+
+//Stops the machine, the message is shown by the frontend
+void Chip8::fail(const std::string& message) {
+	state.running = false;
+	state.error = true;
+
+	errorMessage = message;
+}
+
+void Chip8::saveState(Chip8State& out) const {
+	std::memcpy(&out, &state, sizeof(Chip8State));
+}
+
+void Chip8::loadState(const Chip8State& in) {
+	std::memcpy(&state, &in, sizeof(Chip8State));
+	rehashMemory();
+
+	allocateCache();
+
+	for (auto& ins : cache->decoded) {
+		ins.handler = nullptr;
+	}
+
+	clearBlocks();
+
+	errorMessage = state.error ? "Stopped by an error before the state was saved." : "";
+	dirtyRows = 0xFFFFFFFF;
+}
+
+bool Chip8::saveStateToFile(const std::string& filename) const {
+	std::ofstream file(filename, std::ios::binary);
+
+	if (!file) {
+		return false;
+	}
+
+	Chip8SaveHeader header = { { 'C', '8', 'S', 'T' }, CHIP8_SAVE_VERSION, sizeof(Chip8State), 0 };
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(&state), sizeof(Chip8State));
+
+	return static_cast<bool>(file);
+}
+
+bool Chip8::loadStateFromFile(const std::string& filename) {
+	std::ifstream file(filename, std::ios::binary);
+
+	if (!file) {
+		return false;
+	}
+
+	Chip8SaveHeader header;
+	Chip8State loaded;
+
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+	if (!file || std::memcmp(header.magic, "C8ST", 4) != 0
+		|| header.version != CHIP8_SAVE_VERSION || header.stateSize != sizeof(Chip8State)) {
+		return false;
+	}
+
+	file.read(reinterpret_cast<char*>(&loaded), sizeof(Chip8State));
+
+	//The run loops rely on these, a damaged file must not break them
+	if (!file || loaded.pc >= CHIP8_MEMORY_SIZE || loaded.sp > CHIP8_STACK_SIZE || loaded.instructionsUntilTick == 0 || loaded.randomState == 0) {
+		return false;
+	}
+
+	loadState(loaded);
+
+	return true;
+}
+
+bool Chip8::hasError() const {
+	return state.error;
+}
 
-	errText.setString(ss.str());
+const std::string& Chip8::getErrorMessage() const {
+	return errorMessage;
 }
 
 void Chip8::clearScreen() {
-	for (int x = 0; x < CHIP8_SCREEN_WIDTH; x++) {
-		for (int y = 0; y < CHIP8_SCREEN_HEIGHT; y++) {
-			screen[x][y] = 0;
-		}
+	state.screen.fill(0);
+
+	dirtyRows = 0xFFFFFFFF;
+}
+
+uint32_t Chip8::getDirtyRows() const {
+	return dirtyRows;
+}
+
+void Chip8::clearDirtyRows() {
+	dirtyRows = 0;
+}
+
+bool Chip8::isPixelSet(int x, int y) const {
+	return (state.screen[y] >> (CHIP8_SCREEN_WIDTH - 1 - x)) & 1;
+}
+
+Chip8CycleDetector::Chip8CycleDetector() {
+	saved = 0;
+	power = 1;
+	steps = 0;
+	period = 0;
+	started = false;
+}
+
+bool Chip8CycleDetector::add(uint64_t hash) {
+	if (period) {
+		return true;
 	}
+
+	if (!started) {
+		saved = hash;
+		started = true;
+		return false;
+	}
+
+	steps++;
+
+	if (hash == saved) {
+		period = steps;
+		return true;
+	}
+
+	//Move the saved hash forward, so it ends up inside the cycle
+	if (steps == power) {
+		saved = hash;
+		power *= 2;
+		steps = 0;
+	}
+
+	return false;
+}
+
+unsigned long Chip8CycleDetector::getPeriod() const {
+	return period;
 }
@@ -30,8 +30,14 @@
 #define CHIP8_H
 
 #include <vector>
-#include <SFML/Graphics.hpp>
 #include <array>
+#include <bitset>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
 
 const unsigned int CHIP8_MEMORY_SIZE = 4096u;
 const unsigned int CHIP8_PROGRAM_START = 0x200;
@@ -40,13 +46,33 @@ const unsigned int CHIP8_REGISTERS = 16;
 const unsigned int CARRY_REGISTER = CHIP8_REGISTERS - 1;
 const unsigned int CHIP8_KBD_SIZE = 16;
 const unsigned int CHIP8_DEFAULT_CYCLES = 60;
-const unsigned int CHIP8_CLOCK_SPEED = 60;
+const unsigned int CHIP8_CLOCK_SPEED = 60; //frames per second of emulated time, timers tick once per frame
+const uint64_t CHIP8_DEFAULT_SEED = 1; //random seed of a new machine, so runs are reproducible unless seeded otherwise
 
 const int CHIP8_SCREEN_WIDTH = 64;
 const int CHIP8_SCREEN_HEIGHT = 32;
 
+//Labels as values, used by the block engine to chain blocks with computed goto
+#if defined(__GNUC__)
+#define CHIP8_THREADED_DISPATCH
+#endif
 
-typedef sf::Uint16 Opcode;
+
+typedef uint16_t Opcode;
+
+/*
+	Notified about memory changes that may invalidate code translated
+	outside of Chip8 (see Chip8Jit and Chip8StaticRuntime).
+*/
+class Chip8CodeListener {
+public:
+	virtual ~Chip8CodeListener() {}
+
+	virtual void invalidate(unsigned int address) = 0; //byte at address was written
+	virtual void flush() = 0; //whole memory was reloaded
+};
+
+class Chip8Tracer;
 
 namespace Chip8Opcodes {
 	const Opcode ClearScreen = 0x00E0;
@@ -106,7 +132,18 @@ namespace Chip8Opcodes {
 	const Opcode MemoryToRegisters = 0xF065;
 };
 
-const std::array<sf::Uint8, 80u> fontset = {
+//Instruction pairs run as one operation by the block engine
+enum Chip8Fusion {
+	FUSION_INDEX_DRAW, //Annn, Dxyn
+	FUSION_LOAD_LOAD, //6xkk, 6xkk
+	FUSION_ADD_SKIP, //7xkk, 3xkk or 4xkk
+	FUSION_INDEX_LOAD, //Fx1E, Fx65
+	FUSION_COUNT
+};
+
+const char* const CHIP8_FUSION_NAMES[FUSION_COUNT] = { "Annn+Dxyn", "6xkk+6xkk", "7xkk+3xkk/4xkk", "Fx1E+Fx65" };
+
+const std::array<uint8_t, 80u> fontset = {
 	0xF0, 0x90, 0x90, 0x90, 0xF0, //0
 	0x20, 0x60, 0x20, 0x20, 0x70, //1
 	0xF0, 0x10, 0xF0, 0x80, 0xF0, //2
@@ -125,72 +162,311 @@ const std::array<sf::Uint8, 80u> fontset = {
 	0xF0, 0x80, 0xF0, 0x80, 0x80, //F
 };
 
+/*
+	Complete machine state, a plain block of memory that can be copied,
+	compared or written out as is. Everything else in Chip8 is derived from it
+	(decode caches, blocks) or is configuration.
+*/
+struct Chip8State {
+	std::array<uint8_t, CHIP8_MEMORY_SIZE> memory;
+	std::array<uint64_t, CHIP8_SCREEN_HEIGHT> screen; //one word per row, the most significant bit is x = 0
+	std::array<uint16_t, CHIP8_STACK_SIZE> stack;
+	std::array<uint8_t, CHIP8_REGISTERS> registers;
+
+	uint16_t indexRegister;
+	uint16_t pc; //program counter, or instruction pointer
+	uint16_t sp; //stack pointer
+	uint16_t inputMask; //bit n is set while key n is down
+
+	uint8_t delayTimer;
+	uint8_t soundTimer;
+
+	bool running;
+	bool error; //stopped by a fault, see Chip8::getErrorMessage()
+
+	uint32_t instructionsUntilTick; //never 0 between instructions
+	uint32_t tickCredit; //remainder of cycles / CHIP8_CLOCK_SPEED carried to the next tick
+	uint32_t instructionCredit; //remainder of cycles / CHIP8_CLOCK_SPEED carried to the next frame
+
+	uint64_t randomState; //xorshift64* state of the Cxkk generator, never 0
+};
+
+//Save states copy Chip8State as raw bytes
+static_assert(std::is_trivially_copyable<Chip8State>::value, "Chip8State must stay a plain block of data");
+
+const uint32_t CHIP8_SAVE_VERSION = 1; //bump whenever Chip8State changes
+
+/*
+	Save state file: this header, then the Chip8State bytes as they are in
+	memory (native byte order, little-endian on every supported platform).
+	stateSize catches files written by a build with a different layout.
+*/
+struct Chip8SaveHeader {
+	char magic[4]; //"C8ST"
+	uint32_t version;
+	uint32_t stateSize;
+	uint32_t reserved;
+};
+
+/*
+	Random numbers of Cxkk.
+
+	The generator is xorshift64*: a few shifts and a multiply, and its whole
+	state is one word inside Chip8State, so every machine has its own stream,
+	save states restore it and two machines with the same seed stay bit-exact.
+	The seed is spread with splitmix64 first, so seeds 1, 2, 3... give
+	unrelated streams.
+*/
+inline uint64_t chip8SeedRandom(uint64_t seed) {
+	uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	z ^= z >> 31;
+
+	return z ? z : 0x9E3779B97F4A7C15ull;
+}
+
+inline uint8_t chip8NextRandom(uint64_t& randomState) {
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+
+	return static_cast<uint8_t>((randomState * 0x2545F4914F6CDD1Dull) >> 56);
+}
+
+/*
+	CHIP-8 core. It has no dependency on SFML: the window, input mapping and
+	the debug overlay live in Chip8Frontend.
+*/
 class Chip8 {
 public:
 	Chip8();
 	bool loadFromFile(const std::string& filename);
-	void loadFromMemory(const sf::Uint8* mem, std::size_t sz);
+	void loadFromMemory(const uint8_t* mem, std::size_t sz);
 
-	void prepare(sf::RenderWindow& target);
+	void prepare();
 	void execute();
-	void update();
+	unsigned long executeBlocks(unsigned long maxInstructions);
+	unsigned long executeInstructions(unsigned long maxInstructions);
+	void step();
+	unsigned long skipIdleLoop(unsigned long maxInstructions);
+	unsigned long skipIdleLoops(unsigned long maxInstructions);
+	unsigned long runFrame();
 
 	void printData();
 	void printMemory();
 
+	bool hasSameState(const Chip8& other) const;
+
+	unsigned long getFusionCount(Chip8Fusion fusion) const; //times the pair ran fused since prepare()
+
 	void setRunning(bool arg);
 	bool isRunning();
+	bool isHalted() const; //stopped, or pc is at a jump to itself which only a reset leaves
 
-	void updateDebugText();
-
-	sf::Text errText;
-	sf::Text debugText;
+	bool isPixelSet(int x, int y) const;
 
-	std::array<std::array<sf::Uint8, CHIP8_SCREEN_HEIGHT>, CHIP8_SCREEN_WIDTH> screen;
+	uint32_t getDirtyRows() const; //bit y is set if row y changed since the last clearDirtyRows()
+	void clearDirtyRows();
 
-	void processKeyPress(sf::Event& ev);
-	void processKeyRelease(sf::Event& ev);
+	void pressKey(unsigned int key);
+	void releaseKey(unsigned int key);
+	void setKeys(uint16_t keys); //bit n is set while key n is down, e.g. from a Chip8Movie
 
 	void setCycles(int perSecond);
-	int getCycles();
+	int getCycles() const;
 
-	bool error;
-private:
-	bool running;
-	sf::RenderWindow* window;
+	uint64_t getRomHash() const; //FNV-1a of the loaded ROM, identifies it in movies
+	uint64_t getStateHash() const; //of the whole state, memory hashed incrementally
+
+#ifdef CHIP8_TRACE
+	void setTracer(Chip8Tracer* tracer); //records the instructions run by the interpreter and the block engine, nullptr to stop
+#endif
+
+	void seedRandom(uint64_t seed); //for reproducible runs, each instance has its own generator (Cxkk) in state.randomState
+
+	void saveState(Chip8State& out) const;
+	void loadState(const Chip8State& in); //also drops everything decoded or translated from the old memory
+	bool saveStateToFile(const std::string& filename) const;
+	bool loadStateFromFile(const std::string& filename); //false if the file is missing, from another version or invalid
 
-	unsigned int pc; //program counter, or instruction pointer
-	sf::Uint16 sp; //stack pointer
+	bool hasError() const;
+	const std::string& getErrorMessage() const;
+
+	Chip8State state;
+private:
+	struct DecodedInstruction;
+
+	typedef void (Chip8::*OpcodeHandler)(const DecodedInstruction& ins);
+	typedef void (Chip8::*FusedHandler)(const DecodedInstruction& first, const DecodedInstruction& second);
+
+	//Opcode with its operands already extracted, cached per memory address.
+	//Many ROMs jump over data to odd addresses, so every address gets an entry.
+	struct DecodedInstruction {
+		OpcodeHandler handler; //nullptr if the entry has not been decoded yet
+		Opcode opcode;
+		uint8_t x;
+		uint8_t y;
+		uint8_t n;
+		uint8_t kk;
+		uint16_t nnn;
+		bool endsBlock; //control flow may leave the straight line after this instruction
+	};
+
+	static const std::array<OpcodeHandler, 16> primaryHandlers;
+	static const std::array<OpcodeHandler, 16> registerHandlers;
+	static const std::array<OpcodeHandler, 256> systemHandlers;
+	static const std::array<OpcodeHandler, 256> keyboardHandlers;
+	static const std::array<OpcodeHandler, 256> miscHandlers;
+
+	static std::array<OpcodeHandler, 256> makeByteTable(std::initializer_list<std::pair<uint8_t, OpcodeHandler>> entries);
+
+	DecodedInstruction decode(unsigned int address) const;
+	const DecodedInstruction& decodedAt(unsigned int address); //cached entry, decoded on first use
+	void invalidateDecoded(unsigned int address);
+
+	unsigned int runBlock(unsigned long maxInstructions);
+	uint16_t buildBlock(unsigned int address);
+	void clearBlocks();
+
+#ifdef CHIP8_THREADED_DISPATCH
+	unsigned long runThreaded(unsigned long maxInstructions);
+	static uint8_t threadedOp(OpcodeHandler handler, FusedHandler fused);
+
+	static const OpcodeHandler threadedHandlers[];
+	static const FusedHandler threadedFusions[];
+#endif
+
+	static FusedHandler fuse(const DecodedInstruction& first, const DecodedInstruction& second);
+
+	std::array<unsigned long, FUSION_COUNT> fusionCounts;
+
+	/*
+		Everything derived from the code in memory, one entry per address.
+		It is over 40 times the size of Chip8State, so it is kept out of the
+		machine and only allocated by prepare() or loadState(), before
+		anything runs. A Chip8 that just holds a state stays a few kilobytes.
+	*/
+	struct CodeCache {
+		std::array<DecodedInstruction, CHIP8_MEMORY_SIZE> decoded;
+
+		std::array<uint16_t, CHIP8_MEMORY_SIZE> blockLengths; //instructions in the basic block starting at each address, 0 if not built
+		std::bitset<CHIP8_MEMORY_SIZE> blockCode; //bytes covered by any built block
+		std::bitset<CHIP8_MEMORY_SIZE> idleCandidates; //built blocks starting like an idle loop and loops Chip8StaticRuntime skipped, see skipIdleLoop()
+		std::array<FusedHandler, CHIP8_MEMORY_SIZE> blockFusions; //handler running the instruction at each address together with the next one, nullptr if none
+
+#ifdef CHIP8_THREADED_DISPATCH
+		std::array<uint8_t, CHIP8_MEMORY_SIZE> blockOps; //label of the handler or fused pair at each address of a built block, see runThreaded()
+#endif
+	};
+
+	std::unique_ptr<CodeCache> cache;
+	void allocateCache();
+
+	void fuseIndexDraw(const DecodedInstruction& first, const DecodedInstruction& second);
+	void fuseLoadLoad(const DecodedInstruction& first, const DecodedInstruction& second);
+	void fuseAddSkipIfEqual(const DecodedInstruction& first, const DecodedInstruction& second);
+	void fuseAddSkipIfNotEqual(const DecodedInstruction& first, const DecodedInstruction& second);
+	void fuseIndexLoad(const DecodedInstruction& first, const DecodedInstruction& second);
+
+	friend class Chip8Jit;
+	friend class Chip8Memo;
+	friend class Chip8StaticRuntime;
+	friend class Chip8Aot;
+	Chip8CodeListener* codeListener; //attached by a translating engine, notified about memory writes
+
+	void opClearScreen(const DecodedInstruction& ins);
+	void opReturn(const DecodedInstruction& ins);
+	void opJump(const DecodedInstruction& ins);
+	void opSubroutineCall(const DecodedInstruction& ins);
+	void opSkipIfEqual(const DecodedInstruction& ins);
+	void opSkipIfNotEqual(const DecodedInstruction& ins);
+	void opSkipIfRegistersEqual(const DecodedInstruction& ins);
+	void opSetRegister(const DecodedInstruction& ins);
+	void opRegisterAdd(const DecodedInstruction& ins);
+	void opAssignRegisters(const DecodedInstruction& ins);
+	void opBitwiseOr(const DecodedInstruction& ins);
+	void opBitwiseAnd(const DecodedInstruction& ins);
+	void opBitwiseXor(const DecodedInstruction& ins);
+	void opAddRegisterAndSetCarry(const DecodedInstruction& ins);
+	void opSubtractRegisterAndSetCarry(const DecodedInstruction& ins);
+	void opDivideLSB(const DecodedInstruction& ins);
+	void opSubtractRegisterAndSetCarryYX(const DecodedInstruction& ins);
+	void opMultiplyMSB(const DecodedInstruction& ins);
+	void opSkipIfRegistersNotEqual(const DecodedInstruction& ins);
+	void opSetIndexRegister(const DecodedInstruction& ins);
+	void opSetProgramCounterPlusV0(const DecodedInstruction& ins);
+	void opGenRandom(const DecodedInstruction& ins);
+	void opDrawSprite(const DecodedInstruction& ins);
+	void opSkipIfKeyIsPressed(const DecodedInstruction& ins);
+	void opSkipIfKeyIsNotPressed(const DecodedInstruction& ins);
+	void opGetDelayTimerValue(const DecodedInstruction& ins);
+	void opWaitKeyPress(const DecodedInstruction& ins);
+	void opSetDelayTimer(const DecodedInstruction& ins);
+	void opSetSoundTimer(const DecodedInstruction& ins);
+	void opIndexAdd(const DecodedInstruction& ins);
+	void opIndexSetFont(const DecodedInstruction& ins);
+	void opIndexBCD(const DecodedInstruction& ins);
+	void opRegistersToMemory(const DecodedInstruction& ins);
+	void opMemoryToRegisters(const DecodedInstruction& ins);
 
 	void advance(int a);
 
-	void push(sf::Uint16 value);
-	sf::Uint16 pop();
+	void push(uint16_t value);
+	uint16_t pop();
+
+	void unknownOpcode(const DecodedInstruction& ins);
+
+	void fail(const std::string& message);
 
-	void unknownOpcode(sf::Uint16 opcode);
+	std::string errorMessage;
 
 	void clearScreen();
 
-	std::array<sf::Uint8, CHIP8_MEMORY_SIZE> memory;
-	
-	std::array<sf::Uint16, CHIP8_STACK_SIZE> stack;
+	uint32_t dirtyRows;
 
-	std::array<sf::Uint16, CHIP8_REGISTERS> registers;
-	sf::Uint16 indexRegister;
+	int cycles;
 
-	sf::Uint16 inputMask;
-	std::array<sf::Keyboard::Key, CHIP8_KBD_SIZE> kbdmap;
+	void countInstructions(unsigned long count);
+	void scheduleTick();
+	void tickTimers();
 
-	sf::Uint16 delayTimer;
-	sf::Uint16 soundTimer;
+	void writeMemory(unsigned int address, uint8_t value);
+	void rehashMemory();
 
-	sf::Clock delayClock;
-	sf::Clock soundClock;
+	/*
+		Zobrist-style hash of state.memory: the XOR of one key per
+		(address, value) pair. A write swaps the key of the old byte for the
+		one of the new byte, so the 4 KB are never rehashed while running.
+		The core writes memory only through writeMemory().
+	*/
+	uint64_t memoryHash;
 
-	sf::Clock cycleClock;
-	int cycles;
+	std::vector<uint8_t> data; //raw data loaded from ROM file
 
-	std::vector<sf::Uint8> data; //raw data loaded from ROM file
+#ifdef CHIP8_TRACE
+	Chip8Tracer* tracer;
+#endif
+};
+
+/*
+	Finds out that a machine runs in a loop from one state hash per frame,
+	with Brent's algorithm: the hash at every power of two frames is kept and
+	compared with the ones after it. A cycle is found before frame
+	2 * max(start, length) + length, in constant memory.
+*/
+class Chip8CycleDetector {
+public:
+	Chip8CycleDetector();
+
+	bool add(uint64_t hash); //true once the hashes repeat
+	unsigned long getPeriod() const; //frames in the cycle, 0 until one is found
+private:
+	uint64_t saved;
+	unsigned long power;
+	unsigned long steps; //frames since saved
+	unsigned long period;
+	bool started;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,430 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "Chip8Aot.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+Chip8StaticRuntime::Chip8StaticRuntime(Chip8& target, const Chip8StaticProgram& program) :
+	registers(target.state.registers.data()),
+	memory(target.state.memory.data()),
+	stack(target.state.stack.data()),
+	indexRegister(target.state.indexRegister),
+	sp(target.state.sp),
+	pc(target.state.pc),
+	delayTimer(target.state.delayTimer),
+	soundTimer(target.state.soundTimer),
+	chip8(target),
+	program(program) {
+
+	for (std::size_t i = 0; i < program.codeRangeCount; i++) {
+		for (unsigned int address = program.codeRanges[i][0]; address < program.codeRanges[i][1]; address++) {
+			codeBytes[address] = true;
+		}
+	}
+
+	codeModified = false;
+
+	chip8.codeListener = this;
+}
+
+Chip8StaticRuntime::~Chip8StaticRuntime() {
+	chip8.codeListener = nullptr;
+}
+
+unsigned long Chip8StaticRuntime::execute(unsigned long maxInstructions) {
+	unsigned long executed = 0;
+
+	//Timers tick between runs, like in Chip8::executeBlocks()
+	while (chip8.state.running && executed < maxInstructions) {
+		//Idle loops the generated code met before, see skipIdleLoop()
+		unsigned long ran = chip8.skipIdleLoops(maxInstructions - executed);
+
+		if (ran) {
+			executed += ran;
+			continue;
+		}
+
+		unsigned long slice = std::min<unsigned long>(maxInstructions - executed, chip8.state.instructionsUntilTick);
+
+		if (!codeModified) {
+			ran = program.run(*this, slice);
+			chip8.countInstructions(ran);
+		}
+
+		//The generated code stops before a block that does not fit in the slice,
+		//and does not run at all once it was overwritten
+		if (ran < slice && chip8.state.running) {
+			ran += chip8.executeBlocks(slice - ran);
+		}
+
+		executed += ran;
+	}
+
+	return executed;
+}
+
+void Chip8StaticRuntime::invalidate(unsigned int address) {
+	if (codeBytes[address % CHIP8_MEMORY_SIZE]) {
+		codeModified = true;
+	}
+}
+
+void Chip8StaticRuntime::flush() {
+	//Also called when a write drops the interpreter blocks, so the translated code stays disabled
+}
+
+bool Chip8StaticRuntime::canRun() const {
+	return chip8.state.running && !codeModified;
+}
+
+unsigned int Chip8StaticRuntime::step() {
+	chip8.execute();
+	return 1;
+}
+
+unsigned int Chip8StaticRuntime::stepBlock(unsigned long maxInstructions) {
+	return chip8.runBlock(maxInstructions);
+}
+
+//Also marks the loop for Chip8::skipIdleLoops(), so execute() skips it again without entering the generated code
+unsigned long Chip8StaticRuntime::skipIdleLoop(unsigned long maxInstructions) {
+	unsigned long skipped = chip8.skipIdleLoop(maxInstructions);
+
+	if (skipped) {
+		chip8.cache->idleCandidates[chip8.state.pc] = true;
+	}
+
+	return skipped;
+}
+
+Chip8StaticRegistrar::Chip8StaticRegistrar(const Chip8StaticProgram& program) {
+	Chip8Aot::registerProgram(program);
+}
+
+std::vector<const Chip8StaticProgram*>& Chip8Aot::programs() {
+	static std::vector<const Chip8StaticProgram*> registered;
+	return registered;
+}
+
+void Chip8Aot::registerProgram(const Chip8StaticProgram& program) {
+	programs().push_back(&program);
+}
+
+const Chip8StaticProgram* Chip8Aot::findProgram(const Chip8& chip8) {
+	for (auto program : programs()) {
+		if (program->romSize == chip8.data.size() && std::equal(chip8.data.begin(), chip8.data.end(), program->rom)) {
+			return program;
+		}
+	}
+
+	return nullptr;
+}
+
+static std::string hex(unsigned int value, int digits) {
+	std::stringstream ss;
+	ss << "0x" << std::hex << std::uppercase << std::setw(digits) << std::setfill('0') << value;
+	return ss.str();
+}
+
+bool Chip8Aot::isTranslated(const Chip8::DecodedInstruction& ins) {
+	const auto handler = ins.handler;
+
+	return handler == &Chip8::opReturn
+		|| handler == &Chip8::opJump
+		|| handler == &Chip8::opSubroutineCall
+		|| handler == &Chip8::opSkipIfEqual
+		|| handler == &Chip8::opSkipIfNotEqual
+		|| handler == &Chip8::opSkipIfRegistersEqual
+		|| handler == &Chip8::opSetRegister
+		|| handler == &Chip8::opRegisterAdd
+		|| handler == &Chip8::opAssignRegisters
+		|| handler == &Chip8::opBitwiseOr
+		|| handler == &Chip8::opBitwiseAnd
+		|| handler == &Chip8::opBitwiseXor
+		|| handler == &Chip8::opAddRegisterAndSetCarry
+		|| handler == &Chip8::opSubtractRegisterAndSetCarry
+		|| handler == &Chip8::opDivideLSB
+		|| handler == &Chip8::opSubtractRegisterAndSetCarryYX
+		|| handler == &Chip8::opMultiplyMSB
+		|| handler == &Chip8::opSkipIfRegistersNotEqual
+		|| handler == &Chip8::opSetIndexRegister
+		|| handler == &Chip8::opSetProgramCounterPlusV0
+		|| handler == &Chip8::opGetDelayTimerValue
+		|| handler == &Chip8::opSetDelayTimer
+		|| handler == &Chip8::opSetSoundTimer
+		|| handler == &Chip8::opIndexAdd
+		|| handler == &Chip8::opIndexSetFont
+		|| handler == &Chip8::opMemoryToRegisters;
+}
+
+/*
+	Writes the C++ statements for one translated instruction, mirroring its
+	handler in Chip8.cpp. Instructions that end a block also set pc and add
+	blockLength (which includes them) to the executed count.
+*/
+void Chip8Aot::writeInstruction(const Chip8::DecodedInstruction& ins, unsigned int address, unsigned int blockLength, std::ostream& out) {
+	const auto handler = ins.handler;
+
+	const std::string vx = "V[" + hex(ins.x, 1) + "]";
+	const std::string vy = "V[" + hex(ins.y, 1) + "]";
+	const std::string next = hex(address + 2, 3);
+	const std::string skip = hex(address + 4, 3);
+	const std::string count = "\t\t\texecuted += " + std::to_string(blockLength) + ";\n";
+
+	//Stack faults are left to the interpreter, which reports them
+	const std::string fault = "{ executed += " + std::to_string(blockLength - 1) + "; pc = " + hex(address, 3) + "; executed += rt.step(); continue; }";
+
+	out << "\t\t\t//" << hex(address, 3) << ": " << hex(ins.opcode, 4) << "\n";
+
+	if (handler == &Chip8::opReturn) {
+		out << "\t\t\tif (sp == 0) " << fault << "\n";
+		out << "\t\t\tpc = stack[--sp] + 2;\n" << count;
+	} else if (handler == &Chip8::opJump) {
+		out << "\t\t\tpc = " << hex(ins.nnn, 3) << ";\n" << count;
+	} else if (handler == &Chip8::opSubroutineCall) {
+		out << "\t\t\tif (sp >= CHIP8_STACK_SIZE) " << fault << "\n";
+		out << "\t\t\tstack[sp++] = " << hex(address, 3) << ";\n";
+		out << "\t\t\tpc = " << hex(ins.nnn, 3) << ";\n" << count;
+	} else if (handler == &Chip8::opSkipIfEqual) {
+		out << "\t\t\tpc = " << vx << " == " << hex(ins.kk, 2) << " ? " << skip << " : " << next << ";\n" << count;
+	} else if (handler == &Chip8::opSkipIfNotEqual) {
+		out << "\t\t\tpc = " << vx << " != " << hex(ins.kk, 2) << " ? " << skip << " : " << next << ";\n" << count;
+	} else if (handler == &Chip8::opSkipIfRegistersEqual) {
+		out << "\t\t\tpc = " << vx << " == " << vy << " ? " << skip << " : " << next << ";\n" << count;
+	} else if (handler == &Chip8::opSkipIfRegistersNotEqual) {
+		out << "\t\t\tpc = " << vx << " != " << vy << " ? " << skip << " : " << next << ";\n" << count;
+	} else if (handler == &Chip8::opSetProgramCounterPlusV0) {
+		out << "\t\t\tpc = " << hex(ins.nnn, 3) << " + V[0x0];\n" << count;
+	} else if (handler == &Chip8::opSetRegister) {
+		out << "\t\t\t" << vx << " = " << hex(ins.kk, 2) << ";\n";
+	} else if (handler == &Chip8::opRegisterAdd) {
+		out << "\t\t\t" << vx << " += " << hex(ins.kk, 2) << ";\n";
+	} else if (handler == &Chip8::opAssignRegisters) {
+		out << "\t\t\t" << vx << " = " << vy << ";\n";
+	} else if (handler == &Chip8::opBitwiseOr) {
+		out << "\t\t\t" << vx << " = " << vx << " | " << vy << ";\n";
+	} else if (handler == &Chip8::opBitwiseAnd) {
+		out << "\t\t\t" << vx << " = " << vx << " & " << vy << ";\n";
+	} else if (handler == &Chip8::opBitwiseXor) {
+		out << "\t\t\t" << vx << " = " << vx << " ^ " << vy << ";\n";
+	} else if (handler == &Chip8::opAddRegisterAndSetCarry) {
+		out << "\t\t\tV[0xF] = " << vx << " + " << vy << " > 255 ? 1 : 0;\n";
+		out << "\t\t\t" << vx << " += " << vy << ";\n";
+	} else if (handler == &Chip8::opSubtractRegisterAndSetCarry) {
+		out << "\t\t\tV[0xF] = " << vx << " > " << vy << " ? 1 : 0;\n";
+		out << "\t\t\t" << vx << " -= " << vy << ";\n";
+	} else if (handler == &Chip8::opDivideLSB) {
+		out << "\t\t\tV[0xF] = " << vx << " & 0x1;\n";
+		out << "\t\t\t" << vx << " = " << vx << " >> 1;\n";
+	} else if (handler == &Chip8::opSubtractRegisterAndSetCarryYX) {
+		out << "\t\t\t" << vx << " = " << vy << " - " << vx << ";\n";
+		out << "\t\t\tV[0xF] = " << vy << " > " << vx << " ? 1 : 0;\n";
+	} else if (handler == &Chip8::opMultiplyMSB) {
+		out << "\t\t\tV[0xF] = " << vx << " >> 7;\n";
+		out << "\t\t\t" << vx << " <<= 1;\n";
+	} else if (handler == &Chip8::opSetIndexRegister) {
+		out << "\t\t\tI = " << hex(ins.nnn, 3) << ";\n";
+	} else if (handler == &Chip8::opGetDelayTimerValue) {
+		out << "\t\t\t" << vx << " = rt.delayTimer;\n";
+	} else if (handler == &Chip8::opSetDelayTimer) {
+		out << "\t\t\trt.delayTimer = " << vx << ";\n";
+	} else if (handler == &Chip8::opSetSoundTimer) {
+		out << "\t\t\trt.soundTimer = " << vx << ";\n";
+	} else if (handler == &Chip8::opIndexAdd) {
+		out << "\t\t\tI = I + " << vx << ";\n";
+	} else if (handler == &Chip8::opIndexSetFont) {
+		out << "\t\t\tI = " << vx << " * 0x5;\n";
+	} else if (handler == &Chip8::opMemoryToRegisters) {
+		for (unsigned int i = 0; i <= ins.x; i++) {
+			out << "\t\t\tV[" << hex(i, 1) << "] = memory[(I + " << i << ") & 0x0FFF];\n";
+		}
+	}
+}
+
+bool Chip8Aot::generate(const std::vector<uint8_t>& rom, const std::string& name, std::ostream& out) {
+	if (rom.empty()) return false;
+
+	Chip8 chip8;
+	chip8.loadFromMemory(rom.data(), rom.size());
+	chip8.prepare();
+
+	const unsigned int romEnd = CHIP8_PROGRAM_START + std::min<unsigned int>(rom.size(), CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START);
+
+	std::bitset<CHIP8_MEMORY_SIZE> code; //discovered instruction addresses
+	std::bitset<CHIP8_MEMORY_SIZE> leaders; //addresses starting a block
+	std::vector<unsigned int> pending = { CHIP8_PROGRAM_START };
+
+	leaders[CHIP8_PROGRAM_START] = true;
+
+	//Follow every statically known path through the ROM
+	while (!pending.empty()) {
+		unsigned int address = pending.back();
+		pending.pop_back();
+
+		if (address < CHIP8_PROGRAM_START || address + 1 >= romEnd || code[address]) continue;
+
+		code[address] = true;
+
+		const Chip8::DecodedInstruction ins = chip8.decode(address);
+		const auto handler = ins.handler;
+
+		auto follow = [&](unsigned int target, bool leader) {
+			if (target >= CHIP8_MEMORY_SIZE) return;
+			if (leader) leaders[target] = true;
+			pending.push_back(target);
+		};
+
+		if (!isTranslated(ins)) {
+			leaders[address] = true;
+
+			if (handler == &Chip8::unknownOpcode) continue;
+
+			follow(address + 2, true);
+
+			if (handler == &Chip8::opSkipIfKeyIsPressed || handler == &Chip8::opSkipIfKeyIsNotPressed) {
+				follow(address + 4, true);
+			}
+		} else if (handler == &Chip8::opJump) {
+			follow(ins.nnn, true);
+		} else if (handler == &Chip8::opSubroutineCall) {
+			follow(ins.nnn, true);
+			follow(address + 2, true);
+		} else if (ins.endsBlock && handler != &Chip8::opReturn && handler != &Chip8::opSetProgramCounterPlusV0) {
+			follow(address + 2, true);
+			follow(address + 4, true);
+		} else if (!ins.endsBlock) {
+			follow(address + 2, false);
+		}
+	}
+
+	out << "//Generated by eightplay --aot from " << name << ", do not edit.\n";
+	out << "//Build it with the eightplay sources, their directory on the include path.\n\n";
+	out << "#include \"Chip8Aot.h\"\n\n";
+	out << "namespace {\n\n";
+
+	out << "const uint8_t rom[] = {";
+	for (std::size_t i = 0; i < rom.size(); i++) {
+		out << (i % 16 == 0 ? "\n\t" : " ") << hex(rom[i], 2) << ",";
+	}
+	out << "\n};\n\n";
+
+	std::stringstream body;
+	std::vector<std::pair<unsigned int, unsigned int>> ranges;
+
+	for (unsigned int start = 0; start < CHIP8_MEMORY_SIZE; start++) {
+		if (!leaders[start] || !code[start]) continue;
+
+		body << "\t\tcase " << hex(start, 3) << ":\n";
+
+		const Chip8::DecodedInstruction first = chip8.decode(start);
+
+		//Same idle loop candidates as Chip8::buildBlock(), fast-forwarded like in Chip8::executeBlocks()
+		if ((first.handler == &Chip8::opJump && first.nnn == start) || first.handler == &Chip8::opGetDelayTimerValue || first.handler == &Chip8::opWaitKeyPress) {
+			body << "\t\t\tif (unsigned long skipped = rt.skipIdleLoop(maxInstructions - executed)) { executed += skipped; continue; }\n";
+		}
+
+		if (!isTranslated(first)) {
+			body << "\t\t\t//" << hex(start, 3) << ": " << hex(first.opcode, 4) << "\n";
+			body << "\t\t\texecuted += rt.step();\n";
+			body << "\t\t\tcontinue;\n";
+			continue;
+		}
+
+		//Extend the block until it ends, meets another block or an untranslated instruction
+		unsigned int end = start;
+		std::vector<Chip8::DecodedInstruction> block;
+
+		while (true) {
+			const Chip8::DecodedInstruction ins = chip8.decode(end);
+			block.push_back(ins);
+			end += 2;
+
+			if (ins.endsBlock || !code[end] || leaders[end]) break;
+		}
+
+		if (block.size() > 1) {
+			body << "\t\t\tif (maxInstructions - executed < " << block.size() << ") return executed;\n";
+		}
+
+		for (std::size_t i = 0; i < block.size(); i++) {
+			writeInstruction(block[i], start + i * 2, block.size(), body);
+		}
+
+		if (!block.back().endsBlock) {
+			body << "\t\t\tpc = " << hex(end, 3) << ";\n";
+			body << "\t\t\texecuted += " << block.size() << ";\n";
+		}
+
+		body << "\t\t\tcontinue;\n";
+
+		ranges.push_back(std::make_pair(start, end));
+	}
+
+	out << "const uint16_t codeRanges[][2] = {\n";
+	for (auto& range : ranges) {
+		out << "\t{ " << hex(range.first, 3) << ", " << hex(range.second, 3) << " },\n";
+	}
+	if (ranges.empty()) {
+		out << "\t{ 0x000, 0x000 },\n";
+	}
+	out << "};\n\n";
+
+	out << "unsigned long run(Chip8StaticRuntime& rt, unsigned long maxInstructions) {\n";
+	out << "\tuint8_t* V = rt.registers;\n";
+	out << "\tuint8_t* memory = rt.memory;\n";
+	out << "\tuint16_t* stack = rt.stack;\n";
+	out << "\tuint16_t& I = rt.indexRegister;\n";
+	out << "\tuint16_t& sp = rt.sp;\n";
+	out << "\tuint16_t& pc = rt.pc;\n\n";
+	out << "\tunsigned long executed = 0;\n\n";
+	out << "\twhile (executed < maxInstructions && rt.canRun()) {\n";
+	out << "\t\tswitch (pc) {\n";
+	out << body.str();
+	out << "\t\tdefault:\n";
+	out << "\t\t\texecuted += rt.stepBlock(maxInstructions - executed);\n";
+	out << "\t\t\tcontinue;\n";
+	out << "\t\t}\n";
+	out << "\t}\n\n";
+	out << "\treturn executed;\n";
+	out << "}\n\n";
+
+	std::string escapedName;
+	for (char c : name) {
+		if (c == '"' || c == '\\') escapedName += '\\';
+		escapedName += c;
+	}
+
+	out << "const Chip8StaticProgram program = { \"" << escapedName << "\", rom, sizeof(rom), codeRanges, "
+		<< ranges.size() << ", run };\n";
+	out << "const Chip8StaticRegistrar registrar(program);\n\n";
+	out << "}\n";
+
+	return true;
+}
@@ -0,0 +1,116 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef CHIP8AOT_H
+#define CHIP8AOT_H
+
+#include "Chip8.h"
+#include <ostream>
+
+class Chip8StaticRuntime;
+
+//Entry point of a generated program, runs at most maxInstructions and returns how many were executed
+typedef unsigned long (*Chip8StaticFunction)(Chip8StaticRuntime& rt, unsigned long maxInstructions);
+
+//ROM compiled ahead of time by Chip8Aot::generate()
+struct Chip8StaticProgram {
+	const char* name;
+	const uint8_t* rom;
+	std::size_t romSize;
+	const uint16_t (*codeRanges)[2]; //[start, end) of every translated block
+	std::size_t codeRangeCount;
+	Chip8StaticFunction run;
+};
+
+/*
+	Runs a Chip8StaticProgram against a prepared Chip8.
+
+	Generated code works directly on the Chip8 state exposed below.
+	Instructions it does not translate, addresses it did not discover
+	(computed Bnnn jumps, code reached only through data) and everything
+	after a write into translated code go through the interpreter.
+*/
+class Chip8StaticRuntime : public Chip8CodeListener {
+public:
+	Chip8StaticRuntime(Chip8& target, const Chip8StaticProgram& program);
+	~Chip8StaticRuntime();
+
+	unsigned long execute(unsigned long maxInstructions);
+
+	void invalidate(unsigned int address) override;
+	void flush() override;
+
+	bool canRun() const;
+	unsigned int step(); //one interpreted instruction at pc
+	unsigned int stepBlock(unsigned long maxInstructions); //one interpreted basic block at pc, or one instruction if the block is longer
+	unsigned long skipIdleLoop(unsigned long maxInstructions); //see Chip8::skipIdleLoop(), 0 if pc is not at an idle loop
+
+	uint8_t* const registers;
+	uint8_t* const memory;
+	uint16_t* const stack;
+	uint16_t& indexRegister;
+	uint16_t& sp;
+	uint16_t& pc;
+	uint8_t& delayTimer;
+	uint8_t& soundTimer;
+private:
+	Chip8& chip8;
+	const Chip8StaticProgram& program;
+
+	std::bitset<CHIP8_MEMORY_SIZE> codeBytes;
+	bool codeModified;
+};
+
+//Registers a generated program at startup, so it is picked for a matching ROM
+class Chip8StaticRegistrar {
+public:
+	explicit Chip8StaticRegistrar(const Chip8StaticProgram& program);
+};
+
+/*
+	Ahead-of-time recompiler.
+
+	generate() follows the control flow of a ROM from 0x200 and writes a C++
+	translation unit with one switch case per basic block. Adding that file to
+	the build registers the program, and findProgram() then returns it for a
+	Chip8 loaded with the same ROM.
+*/
+class Chip8Aot {
+public:
+	static bool generate(const std::vector<uint8_t>& rom, const std::string& name, std::ostream& out);
+
+	static void registerProgram(const Chip8StaticProgram& program);
+	static const Chip8StaticProgram* findProgram(const Chip8& chip8);
+private:
+	static std::vector<const Chip8StaticProgram*>& programs();
+
+	static bool isTranslated(const Chip8::DecodedInstruction& ins);
+	static void writeInstruction(const Chip8::DecodedInstruction& ins, unsigned int address, unsigned int blockLength, std::ostream& out);
+};
+
+#endif
@@ -0,0 +1,219 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "Chip8Batch.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+Chip8Batch::Chip8Batch(int cycles, unsigned long maxFrames) : cycles(cycles), maxFrames(maxFrames), steals(0) {
+
+}
+
+bool Chip8Batch::loadRom(const std::string& filename, std::vector<uint8_t>& rom) {
+	std::ifstream file(filename, std::ios::binary);
+
+	if (!file) {
+		return false;
+	}
+
+	rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+	return true;
+}
+
+/*
+	Input script: one "<frame> <keys>" pair per line, keys being the hex mask
+	of the keys held down from that frame on (bit n for key n).
+	Empty lines and lines starting with # are skipped.
+*/
+bool Chip8Batch::loadInputScript(const std::string& filename, std::vector<Chip8InputEvent>& events) {
+	std::ifstream file(filename);
+
+	if (!file) {
+		return false;
+	}
+
+	events.clear();
+
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#') continue;
+
+		std::istringstream fields(line);
+		Chip8InputEvent event;
+		unsigned int keys;
+
+		if (!(fields >> event.frame >> std::hex >> keys) || keys > 0xFFFF) {
+			return false;
+		}
+
+		event.keys = static_cast<uint16_t>(keys);
+		events.push_back(event);
+	}
+
+	std::stable_sort(events.begin(), events.end(), [](const Chip8InputEvent& a, const Chip8InputEvent& b) {
+		return a.frame < b.frame;
+	});
+
+	return true;
+}
+
+void Chip8Batch::add(const Chip8BatchJob& job) {
+	jobs.push_back(job);
+}
+
+void Chip8Batch::run(unsigned int threads) {
+	threads = std::max(1u, std::min<unsigned int>(threads, static_cast<unsigned int>(jobs.size())));
+
+	results.assign(jobs.size(), Chip8BatchResult());
+	steals = 0;
+
+	queues.clear();
+	for (unsigned int i = 0; i < threads; i++) {
+		queues.emplace_back(new WorkQueue());
+	}
+
+	for (std::size_t job = 0; job < jobs.size(); job++) {
+		queues[job % threads]->jobs.push_back(job);
+	}
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < threads; i++) {
+		workers.emplace_back(&Chip8Batch::work, this, i);
+	}
+
+	work(0);
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void Chip8Batch::work(unsigned int worker) {
+	std::size_t job;
+
+	while (takeJob(worker, job)) {
+		results[job] = runJob(jobs[job]);
+	}
+}
+
+//No job is added while the batch runs, so all queues being empty means it is done
+bool Chip8Batch::takeJob(unsigned int worker, std::size_t& job) {
+	{
+		WorkQueue& own = *queues[worker];
+		std::lock_guard<std::mutex> lock(own.mutex);
+
+		if (!own.jobs.empty()) {
+			job = own.jobs.back();
+			own.jobs.pop_back();
+			return true;
+		}
+	}
+
+	for (std::size_t i = 1; i < queues.size(); i++) {
+		WorkQueue& victim = *queues[(worker + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+
+		if (!victim.jobs.empty()) {
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			steals++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+Chip8BatchResult Chip8Batch::runJob(const Chip8BatchJob& job) const {
+	Chip8 chip8;
+
+	chip8.loadFromMemory(job.rom->data(), job.rom->size());
+	chip8.setCycles(cycles);
+	chip8.prepare();
+	chip8.seedRandom(job.seed);
+
+	Chip8BatchResult result = Chip8BatchResult();
+	std::size_t nextInput = 0;
+	Chip8CycleDetector cycle;
+
+	while (result.frames < maxFrames && !chip8.isHalted()) {
+		while (job.input && nextInput < job.input->size() && (*job.input)[nextInput].frame <= result.frames) {
+			chip8.state.inputMask = (*job.input)[nextInput++].keys;
+		}
+
+		result.instructions += chip8.runFrame();
+		result.frames++;
+
+		//A key press still to come can break the loop
+		if (job.input && nextInput < job.input->size()) {
+			continue;
+		}
+
+		if (cycle.add(chip8.getStateHash())) {
+			result.loopPeriod = cycle.getPeriod();
+			break;
+		}
+	}
+
+	result.screenHash = hashBytes(chip8.state.screen.data(), sizeof(chip8.state.screen));
+	result.stateHash = hashBytes(&chip8.state, sizeof(chip8.state));
+	result.pc = chip8.state.pc;
+	result.halted = chip8.isHalted();
+	result.error = chip8.hasError();
+
+	return result;
+}
+
+const std::vector<Chip8BatchJob>& Chip8Batch::getJobs() const {
+	return jobs;
+}
+
+const std::vector<Chip8BatchResult>& Chip8Batch::getResults() const {
+	return results;
+}
+
+unsigned long Chip8Batch::getSteals() const {
+	return steals;
+}
+
+//64-bit FNV-1a
+uint64_t Chip8Batch::hashBytes(const void* data, std::size_t size) {
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	for (std::size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
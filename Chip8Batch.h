@@ -0,0 +1,112 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef CHIP8BATCH_H
+#define CHIP8BATCH_H
+
+#include "Chip8.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+//Keys held down from a frame on, one line of an input script
+struct Chip8InputEvent {
+	unsigned long frame;
+	uint16_t keys; //bit n is set while key n is down
+};
+
+struct Chip8BatchJob {
+	std::string name; //ROM file, for reports
+	const std::vector<uint8_t>* rom;
+	unsigned long seed;
+	const std::vector<Chip8InputEvent>* input; //sorted by frame, nullptr if no key is pressed
+};
+
+struct Chip8BatchResult {
+	unsigned long instructions;
+	unsigned long frames;
+	uint64_t screenHash;
+	uint64_t stateHash; //whole Chip8State
+	uint16_t pc;
+	unsigned long loopPeriod; //frames, if the job was stopped for repeating its state, else 0
+	bool halted;
+	bool error;
+};
+
+/*
+	Runs many independent emulator instances on a pool of threads.
+
+	Every job is a ROM, a random seed and an optional input script, run
+	headless for a number of frames or until it halts. Jobs are dealt out to
+	one queue per worker up front. A worker takes jobs from the back of its
+	own queue, and once that is empty steals from the front of the others.
+	Instances share nothing but the read-only ROM and script data, so a job
+	gives the same result whichever thread runs it.
+
+	A job whose whole state repeats after its last scripted key press is
+	stuck in a loop that can never end, so it is stopped there instead of
+	running until the frame limit.
+*/
+class Chip8Batch {
+public:
+	Chip8Batch(int cycles, unsigned long maxFrames);
+
+	static bool loadRom(const std::string& filename, std::vector<uint8_t>& rom);
+	static bool loadInputScript(const std::string& filename, std::vector<Chip8InputEvent>& events);
+
+	void add(const Chip8BatchJob& job);
+	void run(unsigned int threads);
+
+	const std::vector<Chip8BatchJob>& getJobs() const;
+	const std::vector<Chip8BatchResult>& getResults() const; //same order as the jobs
+	unsigned long getSteals() const; //jobs run by another worker than the one they were dealt to
+
+	Chip8BatchResult runJob(const Chip8BatchJob& job) const;
+private:
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<std::size_t> jobs;
+	};
+
+	void work(unsigned int worker);
+	bool takeJob(unsigned int worker, std::size_t& job);
+
+	static uint64_t hashBytes(const void* data, std::size_t size);
+
+	int cycles;
+	unsigned long maxFrames;
+
+	std::vector<Chip8BatchJob> jobs;
+	std::vector<Chip8BatchResult> results;
+
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+	std::atomic<unsigned long> steals;
+};
+
+#endif
@@ -0,0 +1,413 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "Chip8Frontend.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+Chip8Frontend::Chip8Frontend(Chip8& target, sf::RenderWindow& targetWindow, const sf::Font& font) :
+	chip8(target),
+	window(targetWindow),
+	rowPixels(CHIP8_SCREEN_WIDTH * 4) {
+	kbdmap[0x1] = sf::Keyboard::Key::Num1;
+	kbdmap[0x2] = sf::Keyboard::Key::Num2;
+	kbdmap[0x3] = sf::Keyboard::Key::Num3;
+	kbdmap[0xC] = sf::Keyboard::Key::Num4;
+
+	kbdmap[0x4] = sf::Keyboard::Key::Q;
+	kbdmap[0x5] = sf::Keyboard::Key::W;
+	kbdmap[0x6] = sf::Keyboard::Key::E;
+	kbdmap[0xD] = sf::Keyboard::Key::R;
+
+	kbdmap[0x7] = sf::Keyboard::Key::A;
+	kbdmap[0x8] = sf::Keyboard::Key::S;
+	kbdmap[0x9] = sf::Keyboard::Key::D;
+	kbdmap[0xE] = sf::Keyboard::Key::F;
+
+	kbdmap[0xA] = sf::Keyboard::Key::Z;
+	kbdmap[0x0] = sf::Keyboard::Key::X;
+	kbdmap[0xB] = sf::Keyboard::Key::C;
+	kbdmap[0xF] = sf::Keyboard::Key::V;
+
+	errText.setFont(font);
+	errText.setCharacterSize(21);
+	errText.setPosition(10, 10);
+	errText.setFillColor(sf::Color::Yellow);
+	errText.setString(chip8.getErrorMessage());
+
+	debugLabels.setFont(font);
+	debugLabels.setCharacterSize(18);
+	debugLabels.setFillColor(sf::Color(160, 160, 160));
+
+	debugText.setFont(font);
+	debugText.setCharacterSize(18);
+
+	debugValues[0] = '\0';
+
+	//Changed screen rows are uploaded to a 64x32 texture, which is scaled up as a single sprite
+	const int PIXEL_SIZE = (int)window.getSize().x / CHIP8_SCREEN_WIDTH;
+
+	screenTexture.create(CHIP8_SCREEN_WIDTH, CHIP8_SCREEN_HEIGHT);
+
+	screenSprite.setTexture(screenTexture);
+	screenSprite.setScale(PIXEL_SIZE, PIXEL_SIZE);
+
+	frameAccumulator = sf::Time::Zero;
+
+	slot = 0;
+
+	rewinding = false;
+
+	movie = nullptr;
+	replaying = false;
+	movieFrame = 0;
+
+	showDebug = true;
+	redraw = true;
+	shownError = chip8.hasError();
+}
+
+void Chip8Frontend::run() {
+	sf::Clock frameClock;
+
+	while (window.isOpen()) {
+		loopClock.restart();
+
+		sf::Event evt;
+		while (window.pollEvent(evt)) {
+			processEvent(evt);
+		}
+
+		update(frameClock.restart());
+
+		present();
+	}
+}
+
+void Chip8Frontend::setSaveFile(const std::string& prefix) {
+	saveFile = prefix;
+}
+
+std::string Chip8Frontend::getSlotFile() const {
+	return saveFile + "." + std::to_string(slot) + ".state";
+}
+
+void Chip8Frontend::setMovie(Chip8Movie* movie, bool replay) {
+	this->movie = movie;
+	replaying = replay;
+	movieFrame = 0;
+}
+
+void Chip8Frontend::saveSlot() {
+	chip8.saveState(slots[slot]);
+	slotUsed[slot] = true;
+
+	if (!saveFile.empty() && !chip8.saveStateToFile(getSlotFile())) {
+		std::cerr << "Error: failed to write " << getSlotFile() << std::endl;
+	}
+
+	std::cout << "Saved slot " << slot << std::endl;
+}
+
+//From memory if the slot was saved in this session, otherwise from its file
+void Chip8Frontend::loadSlot() {
+	if (movie) {
+		std::cout << "Slots cannot be loaded during a movie" << std::endl;
+		return;
+	}
+
+	if (slotUsed[slot]) {
+		chip8.loadState(slots[slot]);
+	} else if (!saveFile.empty() && chip8.loadStateFromFile(getSlotFile())) {
+		chip8.saveState(slots[slot]);
+		slotUsed[slot] = true;
+	} else {
+		std::cout << "Slot " << slot << " is empty" << std::endl;
+		return;
+	}
+
+	frameAccumulator = sf::Time::Zero;
+	redraw = true;
+
+	syncKeys();
+
+	std::cout << "Loaded slot " << slot << std::endl;
+}
+
+void Chip8Frontend::syncKeys() {
+	for (unsigned int i = 0; i < CHIP8_KBD_SIZE; i++) {
+		if (sf::Keyboard::isKeyPressed(kbdmap[i])) {
+			chip8.pressKey(i);
+		} else {
+			chip8.releaseKey(i);
+		}
+	}
+}
+
+void Chip8Frontend::processEvent(const sf::Event& evt) {
+	if (evt.type == sf::Event::Closed) {
+		window.close();
+	}
+
+	if (evt.type == sf::Event::Resized || evt.type == sf::Event::GainedFocus) {
+		redraw = true;
+	}
+
+	if (evt.type != sf::Event::KeyPressed && evt.type != sf::Event::KeyReleased) return;
+
+	if (evt.key.code == sf::Keyboard::Backspace) {
+		rewinding = evt.type == sf::Event::KeyPressed;
+
+		if (!rewinding && !replaying) syncKeys();
+		return;
+	}
+
+	if (evt.type == sf::Event::KeyReleased) {
+		if (evt.key.code == sf::Keyboard::F1) {
+			showDebug = !showDebug;
+			redraw = true;
+			return;
+		}
+
+		if (evt.key.code == sf::Keyboard::F3) {
+			chip8.setRunning(!chip8.isRunning());
+			return;
+		}
+
+		if (!chip8.isRunning() && !movie && evt.key.code == sf::Keyboard::F2) {
+			chip8.step();
+			return;
+		}
+
+		if (evt.key.code == sf::Keyboard::F5) {
+			saveSlot();
+			return;
+		}
+
+		if (evt.key.code == sf::Keyboard::F6) {
+			slot = (slot + 1) % CHIP8_SAVE_SLOTS;
+			std::cout << "Save slot " << slot << std::endl;
+			return;
+		}
+
+		if (evt.key.code == sf::Keyboard::F9) {
+			loadSlot();
+			return;
+		}
+	}
+
+	if (replaying) return;
+
+	for (unsigned int i = 0; i < CHIP8_KBD_SIZE; i++) {
+		if (evt.key.code != kbdmap[i]) continue;
+
+		if (evt.type == sf::Event::KeyPressed) {
+			chip8.pressKey(i);
+		} else {
+			chip8.releaseKey(i);
+		}
+
+		return;
+	}
+}
+
+/*
+	Fixed timestep scheduler.
+
+	Emulated time advances in frames of 1/60 s, independently of how often
+	the window is presented. update() is given the real time since its last
+	call and runs as many whole frames as fit in it, carrying the rest over.
+	While Backspace is held, each of those frames steps back to the
+	previous snapshot instead.
+*/
+void Chip8Frontend::update(sf::Time elapsed) {
+	if (!chip8.isRunning() && !rewinding) return;
+
+	const sf::Time frameTime = sf::microseconds(1000000 / CHIP8_CLOCK_SPEED);
+
+	//After a stall (window dragged, breakpoint) drop the backlog instead of running it in one go
+	frameAccumulator = std::min(frameAccumulator + elapsed, frameTime * static_cast<sf::Int64>(CHIP8_MAX_CATCHUP_FRAMES));
+
+	while ((chip8.isRunning() || rewinding) && frameAccumulator >= frameTime) {
+		frameAccumulator -= frameTime;
+
+		if (rewinding) {
+			Chip8State past;
+
+			if (rewind.pop(past)) {
+				chip8.loadState(past);
+
+				if (movieFrame > 0) movieFrame--;
+			}
+
+			continue;
+		}
+
+		if (replaying && movieFrame >= movie->getFrameCount()) {
+			std::cout << "Movie ended after " << movieFrame << " frames" << std::endl;
+
+			movie = nullptr;
+			replaying = false;
+			syncKeys();
+		}
+
+		if (replaying) {
+			chip8.setKeys(movie->getKeys(movieFrame));
+		} else if (movie) {
+			movie->truncate(movieFrame);
+			movie->record(chip8.state.inputMask);
+		}
+
+		movieFrame++;
+
+		rewind.push(chip8.state);
+		chip8.runFrame();
+	}
+}
+
+void Chip8Frontend::present() {
+	const sf::Time frameTime = sf::microseconds(1000000 / CHIP8_CLOCK_SPEED);
+
+	uint32_t dirtyRows = chip8.getDirtyRows();
+	chip8.clearDirtyRows();
+
+	if (chip8.hasError() != shownError) {
+		shownError = chip8.hasError();
+		errText.setString(chip8.getErrorMessage());
+		redraw = true;
+	}
+
+	//Nothing new to show: skip the present, which is also what limits the framerate
+	if (!dirtyRows && !redraw && !showDebug) {
+		sf::sleep(frameTime - loopClock.getElapsedTime());
+		return;
+	}
+
+	for (int y = 0; y < CHIP8_SCREEN_HEIGHT; y++) {
+		if (!(dirtyRows & (1u << y))) continue;
+
+		expandRow(chip8.state.screen[y], rowPixels.data());
+		screenTexture.update(rowPixels.data(), CHIP8_SCREEN_WIDTH, 1, 0, y);
+	}
+
+	window.clear();
+
+	window.draw(screenSprite);
+
+	if (chip8.hasError()) window.draw(errText);
+
+	if (showDebug) {
+		updateDebugText();
+
+		window.draw(debugLabels);
+		window.draw(debugText);
+	}
+
+	window.display();
+
+	redraw = false;
+}
+
+/*
+	Debug overlay.
+
+	Called once per presented frame while the overlay is shown.
+	Labels are a separate text, laid out once. The values are formatted into
+	a fixed buffer and only handed to debugText, which converts and lays them
+	out again, when they differ from the last frame.
+*/
+void Chip8Frontend::updateDebugText() {
+	if (debugLabels.getString().isEmpty()) {
+		debugLabels.setString("PC\nSP\nI\nKeys\nNext\nV0-V7\nV8-VF\nStack");
+
+		float top = window.getSize().y - debugLabels.getLocalBounds().height - 15;
+
+		debugLabels.setPosition(10, top);
+		debugText.setPosition(10 + debugLabels.getLocalBounds().width + 20, top);
+	}
+
+	const Chip8State& state = chip8.state;
+
+	std::array<char, CHIP8_DEBUG_TEXT_SIZE> text;
+	char* out = text.data();
+
+	out = writeHex(out, state.pc, 3);
+	*out++ = '\n';
+	out = writeHex(out, state.sp, 1);
+	*out++ = '\n';
+	out = writeHex(out, state.indexRegister, 3);
+	*out++ = '\n';
+
+	for (int i = CHIP8_KBD_SIZE - 1; i >= 0; i--) {
+		*out++ = state.inputMask & (1 << i) ? '1' : '0';
+	}
+	*out++ = '\n';
+
+	out = writeHex(out, state.memory[state.pc % CHIP8_MEMORY_SIZE] << 8 | state.memory[(state.pc + 1) % CHIP8_MEMORY_SIZE], 4);
+	*out++ = '\n';
+
+	for (unsigned int r = 0; r < CHIP8_REGISTERS; r++) {
+		out = writeHex(out, state.registers[r], 2);
+		*out++ = r % 8 == 7 ? '\n' : ' ';
+	}
+
+	for (unsigned int i = 0; i < state.sp && i < CHIP8_STACK_SIZE; i++) {
+		out = writeHex(out, state.stack[i], 3);
+		*out++ = ' ';
+	}
+
+	*out = '\0';
+
+	if (std::strcmp(text.data(), debugValues.data()) == 0) return;
+
+	debugValues = text;
+	debugText.setString(debugValues.data());
+}
+
+//Writes value as digits uppercase hex digits, returns the end of the written text
+char* Chip8Frontend::writeHex(char* out, unsigned int value, int digits) {
+	for (int i = digits - 1; i >= 0; i--) {
+		*out++ = "0123456789ABCDEF"[(value >> (i * 4)) & 0xF];
+	}
+
+	return out;
+}
+
+//Writes a screen row as RGBA pixels, white on black
+void Chip8Frontend::expandRow(uint64_t row, uint8_t* pixels) {
+	for (int x = 0; x < CHIP8_SCREEN_WIDTH; x++) {
+		uint8_t value = (row >> (CHIP8_SCREEN_WIDTH - 1 - x)) & 1 ? 255 : 0;
+
+		pixels[0] = value;
+		pixels[1] = value;
+		pixels[2] = value;
+		pixels[3] = 255;
+		pixels += 4;
+	}
+}
@@ -0,0 +1,111 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef CHIP8FRONTEND_H
+#define CHIP8FRONTEND_H
+
+#include "Chip8.h"
+#include "Chip8Movie.h"
+#include "Chip8Rewind.h"
+#include <SFML/Graphics.hpp>
+
+const unsigned int CHIP8_MAX_CATCHUP_FRAMES = 5; //frames update() may run to catch up after a stall
+const unsigned int CHIP8_DEBUG_TEXT_SIZE = 256; //fits every debug overlay value
+const unsigned int CHIP8_SAVE_SLOTS = 10; //F6 cycles through them
+
+/*
+	SFML window around a Chip8: maps the keyboard to the CHIP-8 keypad,
+	runs emulated frames at a fixed 60 Hz step, draws the screen and
+	the debug overlay.
+
+	F5 saves the machine into the current save slot and F9 loads it back.
+	Slots are kept in memory and written to "<save file>.<slot>.state",
+	so a slot saved in an earlier session can be loaded as well.
+
+	Holding Backspace rewinds, one emulated frame back per frame shown.
+
+	With a movie set, the keys held in every frame are recorded into it, or
+	taken from it instead of the keyboard until its last frame.
+*/
+class Chip8Frontend {
+public:
+	Chip8Frontend(Chip8& target, sf::RenderWindow& targetWindow, const sf::Font& font);
+
+	void run(); //until the window is closed
+
+	void setSaveFile(const std::string& prefix); //save slots go to prefix + ".<slot>.state"
+	void setMovie(Chip8Movie* movie, bool replay); //call before run(), the machine must be as the movie starts
+
+	void processEvent(const sf::Event& evt);
+	void update(sf::Time elapsed);
+	void present();
+private:
+	void saveSlot();
+	void loadSlot();
+	std::string getSlotFile() const;
+	void syncKeys(); //after a state was loaded, its pressed keys are not the ones held now
+
+	void updateDebugText();
+	static char* writeHex(char* out, unsigned int value, int digits);
+	static void expandRow(uint64_t row, uint8_t* pixels);
+
+	Chip8& chip8;
+	sf::RenderWindow& window;
+
+	std::array<sf::Keyboard::Key, CHIP8_KBD_SIZE> kbdmap;
+
+	sf::Time frameAccumulator; //real time not yet run as emulated frames
+	sf::Clock loopClock; //time spent in the current loop iteration
+
+	std::vector<uint8_t> rowPixels; //one screen row as RGBA
+	sf::Texture screenTexture;
+	sf::Sprite screenSprite;
+
+	sf::Text errText;
+	sf::Text debugLabels; //names column of the debug overlay
+	sf::Text debugText; //values column of the debug overlay
+	std::array<char, CHIP8_DEBUG_TEXT_SIZE> debugValues; //text last set on debugText
+
+	std::array<Chip8State, CHIP8_SAVE_SLOTS> slots;
+	std::bitset<CHIP8_SAVE_SLOTS> slotUsed;
+	unsigned int slot;
+	std::string saveFile; //no files are written if empty
+
+	Chip8Rewind rewind;
+	bool rewinding; //Backspace is held
+
+	Chip8Movie* movie; //recorded or replayed, nullptr if none
+	bool replaying; //keys come from movie instead of the keyboard
+	unsigned long movieFrame; //frames run since the movie started
+
+	bool showDebug; //F1
+	bool redraw; //the window needs a present even if the screen did not change
+	bool shownError;
+};
+
+#endif
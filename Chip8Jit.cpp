@@ -0,0 +1,668 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "Chip8Jit.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#if defined(CHIP8_JIT_SUPPORTED) && defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(CHIP8_JIT_SUPPORTED)
+#include <sys/mman.h>
+#endif
+
+//x86-64 register numbers
+const int RAX = 0;
+const int RCX = 1;
+const int RDX = 2;
+const int RBX = 3; //Chip8State
+const int RBP = 5;
+const int RSI = 6;
+const int RDI = 7;
+const int R8 = 8;
+const int R9 = 9;
+const int R10 = 10;
+const int R11 = 11;
+const int R12 = 12;
+const int R13 = 13;
+const int R14 = 14;
+const int R15 = 15;
+
+//Host registers for V registers, the ones a block does not have to save first
+const int CACHE_REGISTERS[] = { R8, R9, R10, R11, RSI, RDI, RBP, R12, R13, R14, R15 };
+
+#ifdef _WIN32
+const int ARGUMENT_REGISTERS[] = { RCX, RDX };
+#else
+const int ARGUMENT_REGISTERS[] = { RDI, RSI };
+#endif
+
+static bool isCalleeSaved(int hostReg) {
+#ifdef _WIN32
+	return hostReg == RBX || hostReg == RBP || hostReg == RSI || hostReg == RDI || hostReg >= R12;
+#else
+	return hostReg == RBX || hostReg == RBP || hostReg >= R12;
+#endif
+}
+
+const int32_t REGISTERS_OFFSET = offsetof(Chip8State, registers);
+const int32_t MEMORY_OFFSET = offsetof(Chip8State, memory);
+const int32_t INDEX_OFFSET = offsetof(Chip8State, indexRegister);
+const int32_t PC_OFFSET = offsetof(Chip8State, pc);
+const int32_t INPUT_OFFSET = offsetof(Chip8State, inputMask);
+const int32_t DELAY_OFFSET = offsetof(Chip8State, delayTimer);
+const int32_t SOUND_OFFSET = offsetof(Chip8State, soundTimer);
+
+//Condition codes of cmovcc, taking the skip
+const uint8_t IF_EQUAL = 0x4;
+const uint8_t IF_NOT_EQUAL = 0x5;
+const uint8_t IF_CARRY = 0x2;
+const uint8_t IF_NOT_CARRY = 0x3;
+
+Chip8Jit::Chip8Jit(Chip8& target) : chip8(target) {
+	code = nullptr;
+
+#if defined(CHIP8_JIT_SUPPORTED) && defined(_WIN32)
+	code = static_cast<uint8_t*>(VirtualAlloc(nullptr, CHIP8_JIT_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#elif defined(CHIP8_JIT_SUPPORTED)
+	void* mem = mmap(nullptr, CHIP8_JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	code = mem == MAP_FAILED ? nullptr : static_cast<uint8_t*>(mem);
+#endif
+
+	flush();
+
+	chip8.codeListener = this;
+}
+
+Chip8Jit::~Chip8Jit() {
+	chip8.codeListener = nullptr;
+
+	if (!code) return;
+
+#if defined(CHIP8_JIT_SUPPORTED) && defined(_WIN32)
+	VirtualFree(code, 0, MEM_RELEASE);
+#elif defined(CHIP8_JIT_SUPPORTED)
+	munmap(code, CHIP8_JIT_CODE_SIZE);
+#endif
+}
+
+bool Chip8Jit::isSupported() {
+#ifdef CHIP8_JIT_SUPPORTED
+	return true;
+#else
+	return false;
+#endif
+}
+
+unsigned long Chip8Jit::execute(unsigned long maxInstructions) {
+	if (!code) {
+		return chip8.executeBlocks(maxInstructions);
+	}
+
+	unsigned long executed = 0;
+
+	while (chip8.state.running && executed < maxInstructions) {
+		unsigned long ran = chip8.skipIdleLoops(maxInstructions - executed);
+
+		if (ran) {
+			executed += ran;
+			continue;
+		}
+
+		//Timers tick between runs, like in Chip8::executeBlocks()
+		unsigned long slice = std::min<unsigned long>(maxInstructions - executed, chip8.state.instructionsUntilTick);
+
+		//Translated blocks back to back while they fit, up to the next idle loop like Chip8::runThreaded()
+		while (chip8.state.pc + 1u < CHIP8_MEMORY_SIZE) {
+			const Block& block = blocks[chip8.state.pc];
+
+			if (!block.code || block.length > slice - ran) break;
+			if (ran && chip8.cache->idleCandidates[chip8.state.pc]) break;
+
+			chip8.state.pc = block.code();
+			ran += block.length;
+
+			if (!chip8.state.running) break;
+		}
+
+		if (ran) {
+			executed += ran;
+			chip8.countInstructions(ran);
+
+			//Translated code does not check bounds, let the interpreter stop the machine
+			if (chip8.state.running && chip8.state.pc >= CHIP8_MEMORY_SIZE) {
+				chip8.execute();
+			}
+
+			continue;
+		}
+
+		if (chip8.state.pc + 1u < CHIP8_MEMORY_SIZE) {
+			Block& block = blocks[chip8.state.pc];
+
+			if (!block.code && block.heat >= CHIP8_JIT_HOT_THRESHOLD) {
+				compile(chip8.state.pc);
+
+				if (blocks[chip8.state.pc].code) continue;
+			}
+
+			if (!block.code) block.heat++;
+		}
+
+		//Cold blocks, and translated ones that would run past the next tick
+		ran = chip8.runBlock(slice);
+		executed += ran;
+		chip8.countInstructions(ran);
+	}
+
+	return executed;
+}
+
+void Chip8Jit::invalidate(unsigned int address) {
+	if (translatedCode[address % CHIP8_MEMORY_SIZE]) {
+		flush();
+	}
+}
+
+void Chip8Jit::flush() {
+	for (auto& block : blocks) {
+		block.code = nullptr;
+		block.length = 0;
+		block.heat = 0;
+	}
+
+	translatedCode.reset();
+	codeUsed = 0;
+	compiledBlocks = 0;
+}
+
+unsigned int Chip8Jit::getCompiledBlocks() {
+	return compiledBlocks;
+}
+
+//Switches the code buffer between read/write and read/execute
+bool Chip8Jit::setWritable(bool writable) {
+#if defined(CHIP8_JIT_SUPPORTED) && defined(_WIN32)
+	DWORD old;
+
+	if (!VirtualProtect(code, CHIP8_JIT_CODE_SIZE, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old)) return false;
+	if (!writable) FlushInstructionCache(GetCurrentProcess(), code, CHIP8_JIT_CODE_SIZE);
+
+	return true;
+#elif defined(CHIP8_JIT_SUPPORTED)
+	return mprotect(code, CHIP8_JIT_CODE_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#else
+	(void)writable;
+	return false;
+#endif
+}
+
+void Chip8Jit::compile(unsigned int address) {
+	buffer.clear();
+	hostRegisters.fill(-1);
+	cachedRegisters.clear();
+	savedRegisters.clear();
+	dirtyRegisters = 0;
+
+	//Same block as Chip8::buildBlock(), with the registers its inline opcodes use
+	unsigned int end = address;
+	uint16_t length = 0;
+	bool calls = false;
+
+	while (end + 1 < CHIP8_MEMORY_SIZE) {
+		Chip8::DecodedInstruction& ins = chip8.cache->decoded[end];
+
+		if (!ins.handler) {
+			ins = chip8.decode(end);
+		}
+
+		if (isInline(ins)) {
+			cacheRegisters(ins);
+		} else {
+			calls = true;
+		}
+
+		length++;
+		end += 2;
+
+		if (ins.endsBlock) break;
+	}
+
+	if (length == 0) return;
+
+	//Prologue: save what the caller expects back, point rbx at the state and load the registers
+	savedRegisters.push_back(RBX);
+
+	for (int v : cachedRegisters) {
+		if (isCalleeSaved(hostRegisters[v])) savedRegisters.push_back(hostRegisters[v]);
+	}
+
+	for (int hostReg : savedRegisters) {
+		if (hostReg & 8) emit(0x41);
+		emit(0x50 | (hostReg & 7)); //push
+	}
+
+	//Handler calls need rsp 16-byte aligned and, on Windows, 32 bytes of shadow space
+	frameSize = 0;
+
+	if (calls) {
+		frameSize = savedRegisters.size() % 2 ? 32 : 40;
+		emit(0x48); emit(0x83); emit(0xEC); emit(frameSize); //sub rsp, frameSize
+	}
+
+	emitMoveImmediate64(RBX, reinterpret_cast<uintptr_t>(&chip8.state));
+	emitReload();
+
+	for (unsigned int i = address; i < end; i += 2) {
+		translate(chip8.cache->decoded[i], i);
+	}
+
+	if (!chip8.cache->decoded[end - 2].endsBlock) {
+		emitReturn(end);
+	}
+
+	if (codeUsed + buffer.size() > CHIP8_JIT_CODE_SIZE) {
+		flush();
+	}
+
+	if (!setWritable(true)) return;
+
+	std::memcpy(code + codeUsed, buffer.data(), buffer.size());
+
+	//Nothing translated runs unless the buffer is executable again
+	if (!setWritable(false)) {
+		flush();
+		return;
+	}
+
+	blocks[address].code = reinterpret_cast<BlockFunction>(code + codeUsed);
+	blocks[address].length = length;
+
+	codeUsed += buffer.size();
+	compiledBlocks++;
+
+	for (unsigned int i = address; i < end; i++) {
+		translatedCode[i] = true;
+	}
+}
+
+//Opcodes translate() emits native code for, the others call their handler
+bool Chip8Jit::isInline(const Chip8::DecodedInstruction& ins) {
+	const auto handler = ins.handler;
+
+	return handler != &Chip8::opClearScreen
+		&& handler != &Chip8::opReturn
+		&& handler != &Chip8::opSubroutineCall
+		&& handler != &Chip8::opGenRandom
+		&& handler != &Chip8::opDrawSprite
+		&& handler != &Chip8::opWaitKeyPress
+		&& handler != &Chip8::opIndexBCD
+		&& handler != &Chip8::opRegistersToMemory
+		&& handler != &Chip8::unknownOpcode;
+}
+
+//Gives the V registers the inline code of ins uses a host register while there are any left
+void Chip8Jit::cacheRegisters(const Chip8::DecodedInstruction& ins) {
+	const auto handler = ins.handler;
+
+	if (handler == &Chip8::opMemoryToRegisters) {
+		for (unsigned int i = 0; i <= ins.x; i++) {
+			cacheRegister(i);
+		}
+
+		return;
+	}
+
+	if (handler == &Chip8::opSetProgramCounterPlusV0) {
+		cacheRegister(0);
+		return;
+	}
+
+	if (handler == &Chip8::opJump || handler == &Chip8::opSetIndexRegister) return;
+
+	cacheRegister(ins.x);
+
+	//5xy0, 8xyN and 9xy0 also read Vy
+	unsigned int family = ins.opcode >> 12;
+
+	if (family == 0x5 || family == 0x8 || family == 0x9) {
+		cacheRegister(ins.y);
+	}
+
+	if (handler == &Chip8::opAddRegisterAndSetCarry || handler == &Chip8::opSubtractRegisterAndSetCarry
+		|| handler == &Chip8::opDivideLSB || handler == &Chip8::opSubtractRegisterAndSetCarryYX || handler == &Chip8::opMultiplyMSB) {
+		cacheRegister(CARRY_REGISTER);
+	}
+}
+
+void Chip8Jit::cacheRegister(unsigned int v) {
+	const std::size_t available = sizeof(CACHE_REGISTERS) / sizeof(CACHE_REGISTERS[0]);
+
+	if (hostRegisters[v] != -1 || cachedRegisters.size() == available) return;
+
+	hostRegisters[v] = CACHE_REGISTERS[cachedRegisters.size()];
+	cachedRegisters.push_back(v);
+}
+
+//Runs the handler of the instruction at address, for opcodes translated as a call
+void Chip8Jit::runHandler(Chip8* chip8, unsigned int address) {
+	const Chip8::DecodedInstruction& ins = chip8->cache->decoded[address];
+
+	chip8->state.pc = address;
+	(chip8->*ins.handler)(ins);
+}
+
+/*
+	Emits native code for one instruction, mirroring its handler in Chip8.cpp
+	(including 8-bit register arithmetic). Vx and Vy are read again after
+	every write where the handler does, so x == y or VF as an operand give
+	the same result.
+*/
+void Chip8Jit::translate(const Chip8::DecodedInstruction& ins, unsigned int address) {
+	const auto handler = ins.handler;
+
+	if (!isInline(ins)) {
+		emitCall(address, ins.endsBlock);
+	} else if (handler == &Chip8::opJump) {
+		emitReturn(ins.nnn);
+	} else if (handler == &Chip8::opSkipIfEqual || handler == &Chip8::opSkipIfNotEqual) {
+		emitLoadRegister(RAX, ins.x);
+		emit(0x3D); emit32(ins.kk); //cmp eax, kk
+		emitSkip(address, handler == &Chip8::opSkipIfEqual ? IF_EQUAL : IF_NOT_EQUAL);
+	} else if (handler == &Chip8::opSkipIfRegistersEqual || handler == &Chip8::opSkipIfRegistersNotEqual) {
+		emitLoadRegister(RAX, ins.x);
+		emitLoadRegister(RCX, ins.y);
+		emit(0x39); emit(0xC8); //cmp eax, ecx
+		emitSkip(address, handler == &Chip8::opSkipIfRegistersEqual ? IF_EQUAL : IF_NOT_EQUAL);
+	} else if (handler == &Chip8::opSetRegister) {
+		emitSetRegister(ins.x, ins.kk);
+	} else if (handler == &Chip8::opRegisterAdd) {
+		emitLoadRegister(RAX, ins.x);
+		emit(0x05); emit32(ins.kk); //add eax, kk
+		emitStoreRegister(ins.x, RAX);
+	} else if (handler == &Chip8::opAssignRegisters) {
+		emitLoadRegister(RAX, ins.y);
+		emitStoreRegister(ins.x, RAX);
+	} else if (handler == &Chip8::opBitwiseOr || handler == &Chip8::opBitwiseAnd || handler == &Chip8::opBitwiseXor) {
+		uint8_t operation = handler == &Chip8::opBitwiseOr ? 0x09 : handler == &Chip8::opBitwiseAnd ? 0x21 : 0x31;
+
+		emitLoadRegister(RAX, ins.x);
+		emitLoadRegister(RCX, ins.y);
+		emit(operation); emit(0xC8); //or/and/xor eax, ecx
+		emitStoreRegister(ins.x, RAX);
+	} else if (handler == &Chip8::opAddRegisterAndSetCarry) {
+		emitLoadRegister(RAX, ins.x);
+		emitLoadRegister(RCX, ins.y);
+		emit(0x01); emit(0xC8); //add eax, ecx
+		emit(0x3D); emit32(255); //cmp eax, 255
+		emitSetCarryFromAbove();
+		emitLoadRegister(RAX, ins.x);
+		emitLoadRegister(RCX, ins.y);
+		emit(0x01); emit(0xC8); //add eax, ecx
+		emitStoreRegister(ins.x, RAX);
+	} else if (handler == &Chip8::opSubtractRegisterAndSetCarry) {
+		emitLoadRegister(RAX, ins.x);
+		emitLoadRegister(RCX, ins.y);
+		emit(0x39); emit(0xC8); //cmp eax, ecx
+		emitSetCarryFromAbove();
+		emitLoadRegister(RAX, ins.x);
+		emitLoadRegister(RCX, ins.y);
+		emit(0x29); emit(0xC8); //sub eax, ecx
+		emitStoreRegister(ins.x, RAX);
+	} else if (handler == &Chip8::opDivideLSB) {
+		emitLoadRegister(RAX, ins.x);
+		emit(0x83); emit(0xE0); emit(0x01); //and eax, 1
+		emitStoreRegister(CARRY_REGISTER, RAX);
+		emitLoadRegister(RAX, ins.x);
+		emit(0xD1); emit(0xE8); //shr eax, 1
+		emitStoreRegister(ins.x, RAX);
+	} else if (handler == &Chip8::opSubtractRegisterAndSetCarryYX) {
+		emitLoadRegister(RAX, ins.y);
+		emitLoadRegister(RCX, ins.x);
+		emit(0x29); emit(0xC8); //sub eax, ecx
+		emitStoreRegister(ins.x, RAX);
+		emitLoadRegister(RAX, ins.y);
+		emitLoadRegister(RCX, ins.x);
+		emit(0x39); emit(0xC8); //cmp eax, ecx
+		emitSetCarryFromAbove();
+	} else if (handler == &Chip8::opMultiplyMSB) {
+		emitLoadRegister(RAX, ins.x);
+		emit(0xC1); emit(0xE8); emit(0x07); //shr eax, 7
+		emitStoreRegister(CARRY_REGISTER, RAX);
+		emitLoadRegister(RAX, ins.x);
+		emit(0xD1); emit(0xE0); //shl eax, 1
+		emitStoreRegister(ins.x, RAX);
+	} else if (handler == &Chip8::opSetIndexRegister) {
+		emitMemoryOperand(true, false, { 0xC7 }, 0, RBX, INDEX_OFFSET); //mov word [I], nnn
+		emit16(ins.nnn);
+	} else if (handler == &Chip8::opSetProgramCounterPlusV0) {
+		emitLoadRegister(RAX, 0);
+		emit(0x05); emit32(ins.nnn); //add eax, nnn
+		emitEpilogue();
+	} else if (handler == &Chip8::opSkipIfKeyIsPressed || handler == &Chip8::opSkipIfKeyIsNotPressed) {
+		emitLoadRegister(RCX, ins.x);
+		emit(0x83); emit(0xE1); emit(0x0F); //and ecx, 0xF
+		emitMemoryOperand(false, false, { 0x0F, 0xB7 }, RAX, RBX, INPUT_OFFSET); //movzx eax, word [inputMask]
+		emit(0x0F); emit(0xA3); emit(0xC8); //bt eax, ecx
+		emitSkip(address, handler == &Chip8::opSkipIfKeyIsPressed ? IF_CARRY : IF_NOT_CARRY);
+	} else if (handler == &Chip8::opGetDelayTimerValue) {
+		emitMemoryOperand(false, false, { 0x0F, 0xB6 }, RAX, RBX, DELAY_OFFSET); //movzx eax, byte [delayTimer]
+		emitStoreRegister(ins.x, RAX);
+	} else if (handler == &Chip8::opSetDelayTimer || handler == &Chip8::opSetSoundTimer) {
+		emitLoadRegister(RAX, ins.x);
+		emitMemoryOperand(false, false, { 0x88 }, RAX, RBX, handler == &Chip8::opSetDelayTimer ? DELAY_OFFSET : SOUND_OFFSET); //mov byte [timer], al
+	} else if (handler == &Chip8::opIndexAdd) {
+		emitMemoryOperand(false, false, { 0x0F, 0xB7 }, RAX, RBX, INDEX_OFFSET); //movzx eax, word [I]
+		emitLoadRegister(RCX, ins.x);
+		emit(0x01); emit(0xC8); //add eax, ecx
+		emitMemoryOperand(true, false, { 0x89 }, RAX, RBX, INDEX_OFFSET); //mov word [I], ax
+	} else if (handler == &Chip8::opIndexSetFont) {
+		emitLoadRegister(RAX, ins.x);
+		emit(0x6B); emit(0xC0); emit(0x05); //imul eax, eax, 5
+		emitMemoryOperand(true, false, { 0x89 }, RAX, RBX, INDEX_OFFSET); //mov word [I], ax
+	} else if (handler == &Chip8::opMemoryToRegisters) {
+		emitMemoryOperand(false, false, { 0x0F, 0xB7 }, RDX, RBX, INDEX_OFFSET); //movzx edx, word [I]
+
+		for (unsigned int i = 0; i <= ins.x; i++) {
+			emitMemoryOperand(false, false, { 0x8D }, RAX, RDX, i); //lea eax, [rdx + i]
+			emit(0x25); emit32(CHIP8_MEMORY_SIZE - 1); //and eax, 0xFFF
+			emit(0x0F); emit(0xB6); emit(0x8C); emit(0x03); emit32(MEMORY_OFFSET); //movzx ecx, byte [rbx + rax + memory]
+			emitStoreRegister(i, RCX);
+		}
+	}
+}
+
+void Chip8Jit::emit(uint8_t byte) {
+	buffer.push_back(byte);
+}
+
+void Chip8Jit::emit16(uint16_t value) {
+	emit(value & 0xFF);
+	emit(value >> 8);
+}
+
+void Chip8Jit::emit32(uint32_t value) {
+	emit16(value & 0xFFFF);
+	emit16(value >> 16);
+}
+
+void Chip8Jit::emit64(uint64_t value) {
+	emit32(value & 0xFFFFFFFF);
+	emit32(value >> 32);
+}
+
+/*
+	[66] [REX] opcode ModRM(reg, [base + disp32]). base must not be rsp or r12.
+	byteReg makes reg 4-7 mean spl-dil instead of ah-bh.
+*/
+void Chip8Jit::emitMemoryOperand(bool wide16, bool rexW, std::initializer_list<uint8_t> opcode, int reg, int base, int32_t disp, bool byteReg) {
+	if (wide16) emit(0x66);
+
+	uint8_t rex = 0x40 | (rexW ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((base & 8) ? 0x01 : 0);
+	if (rex != 0x40 || (byteReg && reg >= 4)) emit(rex);
+
+	for (auto byte : opcode) {
+		emit(byte);
+	}
+
+	emit(0x80 | ((reg & 7) << 3) | (base & 7));
+	emit32(static_cast<uint32_t>(disp));
+}
+
+//[REX] opcode ModRM(reg, rm), both 32-bit registers. A byte rm must be al, cl or dl.
+void Chip8Jit::emitRegisterOperand(std::initializer_list<uint8_t> opcode, int reg, int rm) {
+	uint8_t rex = 0x40 | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+	if (rex != 0x40) emit(rex);
+
+	for (auto byte : opcode) {
+		emit(byte);
+	}
+
+	emit(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+//mov hostReg32, value
+void Chip8Jit::emitMoveImmediate(int hostReg, uint32_t value) {
+	if (hostReg & 8) emit(0x41);
+	emit(0xB8 | (hostReg & 7));
+	emit32(value);
+}
+
+//mov hostReg64, value
+void Chip8Jit::emitMoveImmediate64(int hostReg, uint64_t value) {
+	emit((hostReg & 8) ? 0x49 : 0x48);
+	emit(0xB8 | (hostReg & 7));
+	emit64(value);
+}
+
+//hostReg = Vv, zero-extended
+void Chip8Jit::emitLoadRegister(int hostReg, unsigned int v) {
+	if (hostRegisters[v] != -1) {
+		emitRegisterOperand({ 0x8B }, hostReg, hostRegisters[v]); //mov hostReg, cached
+	} else {
+		emitMemoryOperand(false, false, { 0x0F, 0xB6 }, hostReg, RBX, REGISTERS_OFFSET + v); //movzx hostReg, byte [Vv]
+	}
+}
+
+//Vv = low byte of hostReg (al, cl or dl)
+void Chip8Jit::emitStoreRegister(unsigned int v, int hostReg) {
+	if (hostRegisters[v] != -1) {
+		emitRegisterOperand({ 0x0F, 0xB6 }, hostRegisters[v], hostReg); //movzx cached, al/cl/dl
+		dirtyRegisters |= 1 << v;
+	} else {
+		emitMemoryOperand(false, false, { 0x88 }, hostReg, RBX, REGISTERS_OFFSET + v); //mov byte [Vv], al/cl/dl
+	}
+}
+
+void Chip8Jit::emitSetRegister(unsigned int v, uint8_t value) {
+	if (hostRegisters[v] != -1) {
+		emitMoveImmediate(hostRegisters[v], value);
+		dirtyRegisters |= 1 << v;
+	} else {
+		emitMemoryOperand(false, false, { 0xC6 }, 0, RBX, REGISTERS_OFFSET + v); //mov byte [Vv], value
+		emit(value);
+	}
+}
+
+//Writes the cached registers changed since the last spill back to the state
+void Chip8Jit::emitSpill() {
+	for (int v : cachedRegisters) {
+		if (dirtyRegisters & (1 << v)) {
+			emitMemoryOperand(false, false, { 0x88 }, hostRegisters[v], RBX, REGISTERS_OFFSET + v, true); //mov byte [Vv], cached
+		}
+	}
+
+	dirtyRegisters = 0;
+}
+
+//Loads every cached register from the state
+void Chip8Jit::emitReload() {
+	for (int v : cachedRegisters) {
+		emitMemoryOperand(false, false, { 0x0F, 0xB6 }, hostRegisters[v], RBX, REGISTERS_OFFSET + v); //movzx cached, byte [Vv]
+	}
+}
+
+/*
+	Calls runHandler() for the instruction at address. The handler sees and
+	may change every register, so the cache is written back before and
+	loaded again after, or the block returns the pc the handler left.
+*/
+void Chip8Jit::emitCall(unsigned int address, bool endsBlock) {
+	emitSpill();
+
+	emitMoveImmediate64(ARGUMENT_REGISTERS[0], reinterpret_cast<uintptr_t>(&chip8));
+	emitMoveImmediate(ARGUMENT_REGISTERS[1], address);
+	emitMoveImmediate64(RAX, reinterpret_cast<uintptr_t>(&Chip8Jit::runHandler));
+	emit(0xFF); emit(0xD0); //call rax
+
+	if (endsBlock) {
+		emitMemoryOperand(false, false, { 0x0F, 0xB7 }, RAX, RBX, PC_OFFSET); //movzx eax, word [pc]
+		emitEpilogue();
+	} else {
+		emitReload();
+	}
+}
+
+//Writes the registers back and returns eax
+void Chip8Jit::emitEpilogue() {
+	emitSpill();
+
+	if (frameSize) {
+		emit(0x48); emit(0x83); emit(0xC4); emit(frameSize); //add rsp, frameSize
+	}
+
+	for (auto it = savedRegisters.rbegin(); it != savedRegisters.rend(); ++it) {
+		if (*it & 8) emit(0x41);
+		emit(0x58 | (*it & 7)); //pop
+	}
+
+	emit(0xC3); //ret
+}
+
+//VF = 1 if the last unsigned compare was "above", otherwise 0
+void Chip8Jit::emitSetCarryFromAbove() {
+	emit(0x0F); emit(0x97); emit(0xC2); //seta dl
+	emit(0x0F); emit(0xB6); emit(0xD2); //movzx edx, dl
+	emitStoreRegister(CARRY_REGISTER, RDX);
+}
+
+void Chip8Jit::emitReturn(unsigned int pc) {
+	emitMoveImmediate(RAX, pc);
+	emitEpilogue();
+}
+
+//Returns address + 4 if the condition (of a cmovcc) holds, otherwise address + 2
+void Chip8Jit::emitSkip(unsigned int address, uint8_t condition) {
+	emitMoveImmediate(RAX, address + 2);
+	emitMoveImmediate(RCX, address + 4);
+	emit(0x0F); emit(0x40 | condition); emit(0xC1); //cmovcc eax, ecx
+	emitEpilogue();
+}
@@ -0,0 +1,125 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef CHIP8JIT_H
+#define CHIP8JIT_H
+
+#include "Chip8.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CHIP8_JIT_SUPPORTED
+#endif
+
+const unsigned int CHIP8_JIT_HOT_THRESHOLD = 16; //block executions before it gets translated
+const std::size_t CHIP8_JIT_CODE_SIZE = 1024 * 1024;
+
+/*
+	x86-64 dynamic recompiler.
+
+	Hot basic blocks are translated to native code. Register, index, timer,
+	key and jump opcodes and memory reads are translated inline, the others
+	(Dxyn, Cxkk, calls, memory writes...) call their Chip8 handler. The V
+	registers a block uses live in host registers while it runs: they are
+	loaded on entry and written back before every exit and every handler
+	call, which may read or change them.
+
+	The code buffer is never writable and executable at once: compile()
+	makes it writable to append a block and executable again before it runs.
+
+	On other architectures execute() falls back to Chip8::executeBlocks().
+*/
+class Chip8Jit : public Chip8CodeListener {
+public:
+	explicit Chip8Jit(Chip8& target);
+	~Chip8Jit();
+
+	static bool isSupported();
+
+	unsigned long execute(unsigned long maxInstructions);
+
+	void invalidate(unsigned int address) override;
+	void flush() override;
+
+	unsigned int getCompiledBlocks();
+private:
+	//Translated block, returns the new program counter
+	typedef unsigned int (*BlockFunction)();
+
+	struct Block {
+		BlockFunction code;
+		uint16_t length; //translated CHIP-8 instructions
+		uint8_t heat;
+	};
+
+	void compile(unsigned int address);
+	void translate(const Chip8::DecodedInstruction& ins, unsigned int address);
+	static bool isInline(const Chip8::DecodedInstruction& ins);
+	void cacheRegisters(const Chip8::DecodedInstruction& ins);
+	void cacheRegister(unsigned int v);
+	bool setWritable(bool writable);
+
+	static void runHandler(Chip8* chip8, unsigned int address);
+
+	void emit(uint8_t byte);
+	void emit16(uint16_t value);
+	void emit32(uint32_t value);
+	void emit64(uint64_t value);
+	void emitMemoryOperand(bool wide16, bool rexW, std::initializer_list<uint8_t> opcode, int reg, int base, int32_t disp, bool byteReg = false);
+	void emitRegisterOperand(std::initializer_list<uint8_t> opcode, int reg, int rm);
+	void emitMoveImmediate(int hostReg, uint32_t value);
+	void emitMoveImmediate64(int hostReg, uint64_t value);
+	void emitLoadRegister(int hostReg, unsigned int v);
+	void emitStoreRegister(unsigned int v, int hostReg);
+	void emitSetRegister(unsigned int v, uint8_t value);
+	void emitSpill();
+	void emitReload();
+	void emitCall(unsigned int address, bool endsBlock);
+	void emitEpilogue();
+	void emitSetCarryFromAbove();
+	void emitReturn(unsigned int pc);
+	void emitSkip(unsigned int address, uint8_t condition);
+
+	Chip8& chip8;
+
+	std::array<Block, CHIP8_MEMORY_SIZE> blocks;
+	std::bitset<CHIP8_MEMORY_SIZE> translatedCode; //bytes covered by any translated block
+
+	uint8_t* code; //code buffer, executable except while a block is appended
+	std::size_t codeUsed;
+	std::vector<uint8_t> buffer; //block being translated
+	unsigned int compiledBlocks;
+
+	//Register allocation of the block being translated
+	std::array<int, CHIP8_REGISTERS> hostRegisters; //host register holding each V, -1 if it stays in memory
+	std::vector<int> cachedRegisters; //V registers held in host registers, in allocation order
+	uint16_t dirtyRegisters; //bit v is set while the host register of Vv is newer than memory
+	std::vector<int> savedRegisters; //callee-saved host registers pushed by the prologue
+	uint8_t frameSize; //stack reserved for handler calls, 0 if the block makes none
+};
+
+#endif
@@ -0,0 +1,1345 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "Chip8Lockstep.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <sstream>
+
+Chip8Lockstep::Chip8Lockstep(unsigned int lanes) :
+	lanes(std::max(1u, lanes)),
+	registers(CHIP8_REGISTERS * this->lanes, 0),
+	pc(this->lanes, CHIP8_PROGRAM_START),
+	indexRegister(this->lanes, 0),
+	sp(this->lanes, 0),
+	inputMask(this->lanes, 0),
+	delayTimer(this->lanes, 0),
+	soundTimer(this->lanes, 0),
+	running(this->lanes, 1),
+	error(this->lanes, 0),
+	condition(this->lanes, 0),
+	selected(this->lanes, 0),
+	instructionsUntilTick(this->lanes, 1),
+	tickCredit(this->lanes, 0),
+	instructionCredit(this->lanes, 0),
+	randomState(this->lanes, chip8SeedRandom(CHIP8_DEFAULT_SEED)),
+	remaining(this->lanes, 0),
+	countedRemaining(this->lanes, 0),
+	memory(CHIP8_MEMORY_SIZE * this->lanes, 0),
+	stack(CHIP8_STACK_SIZE * this->lanes, 0),
+	screen(CHIP8_SCREEN_HEIGHT * this->lanes, 0),
+	errorMessages(this->lanes),
+	lanesAt(CHIP8_MEMORY_SIZE, 0) {
+	for (auto& ins : decoded) {
+		ins.handler = nullptr;
+	}
+
+	cycles = CHIP8_DEFAULT_CYCLES;
+
+	groupSteps = 0;
+	groupBudget = 0;
+
+	vectorSteps = 0;
+	scalarSteps = 0;
+	separateInstructions = 0;
+
+	windowSteps = 0;
+	windowInstructions = 0;
+	divergedSteps = 0;
+}
+
+//Call setCycles() first, it sets when the first timer tick happens
+void Chip8Lockstep::loadFromMemory(const uint8_t* rom, std::size_t size) {
+	size = std::min<std::size_t>(size, CHIP8_MEMORY_SIZE - CHIP8_PROGRAM_START);
+
+	for (unsigned int lane = 0; lane < lanes; lane++) {
+		uint8_t* laneMemory = &memory[lane * CHIP8_MEMORY_SIZE];
+
+		std::fill(laneMemory, laneMemory + CHIP8_MEMORY_SIZE, 0);
+		std::memcpy(laneMemory, fontset.data(), fontset.size());
+		std::memcpy(laneMemory + CHIP8_PROGRAM_START, rom, size);
+
+		std::fill(&stack[lane * CHIP8_STACK_SIZE], &stack[lane * CHIP8_STACK_SIZE] + CHIP8_STACK_SIZE, 0);
+
+		instructionCredit[lane] = 0;
+		tickCredit[lane] = 0;
+		instructionsUntilTick[lane] = 0;
+
+		while (instructionsUntilTick[lane] == 0) {
+			scheduleTick(lane);
+		}
+	}
+
+	std::fill(registers.begin(), registers.end(), 0);
+
+	for (auto& ins : decoded) {
+		ins.handler = nullptr;
+	}
+
+	written.reset();
+
+	machines.clear();
+
+	windowSteps = 0;
+	windowInstructions = 0;
+	divergedSteps = 0;
+}
+
+void Chip8Lockstep::setCycles(int perSecond) {
+	if (perSecond > 0) {
+		cycles = perSecond;
+
+		for (auto& machine : machines) {
+			machine->setCycles(perSecond);
+		}
+	}
+}
+
+void Chip8Lockstep::seedRandom(unsigned int lane, uint64_t seed) {
+	if (!machines.empty()) {
+		machines[lane]->seedRandom(seed);
+		return;
+	}
+
+	randomState[lane] = chip8SeedRandom(seed);
+}
+
+void Chip8Lockstep::setKeys(unsigned int lane, uint16_t keys) {
+	if (!machines.empty()) {
+		machines[lane]->setKeys(keys);
+		return;
+	}
+
+	inputMask[lane] = keys;
+}
+
+unsigned long Chip8Lockstep::execute(unsigned long maxInstructions) {
+	unsigned long executed = 0;
+
+	//Lanes count their instructions in 32 bits, longer runs are split
+	while (maxInstructions && machines.empty()) {
+		uint32_t chunk = static_cast<uint32_t>(std::min<unsigned long>(maxInstructions, UINT32_MAX));
+
+		std::fill(remaining.begin(), remaining.end(), chunk);
+
+		executed += run();
+		maxInstructions -= chunk;
+
+		separateIfDiverged();
+	}
+
+	for (auto& machine : machines) {
+		unsigned long ran = machine->executeBlocks(maxInstructions);
+
+		executed += ran;
+		separateInstructions += ran;
+	}
+
+	return executed;
+}
+
+unsigned long Chip8Lockstep::runFrame() {
+	unsigned long executed = 0;
+
+	if (!machines.empty()) {
+		for (auto& machine : machines) {
+			executed += machine->runFrame();
+		}
+
+		separateInstructions += executed;
+
+		return executed;
+	}
+
+	for (unsigned int lane = 0; lane < lanes; lane++) {
+		instructionCredit[lane] += cycles;
+
+		remaining[lane] = instructionCredit[lane] / CHIP8_CLOCK_SPEED;
+		instructionCredit[lane] %= CHIP8_CLOCK_SPEED;
+	}
+
+	executed = run();
+
+	separateIfDiverged();
+
+	return executed;
+}
+
+/*
+	Each round runs the largest group of lanes that share a pc, lowest pc
+	first on a tie. Lanes which stopped or used up their instructions are not
+	part of any group, so they never hold the others back.
+*/
+unsigned long Chip8Lockstep::run() {
+	unsigned long executed = 0;
+
+	std::copy(remaining.begin(), remaining.end(), countedRemaining.begin());
+
+	while (true) {
+		unsigned int active = 0;
+		unsigned int groupPc = UINT_MAX;
+		unsigned int groupSize = 0;
+
+		for (unsigned int lane = 0; lane < lanes; lane++) {
+			if (!running[lane] || !remaining[lane]) continue;
+
+			active++;
+
+			//Fails the lane like Chip8::execute()
+			if (pc[lane] >= CHIP8_MEMORY_SIZE) {
+				executed += stepLane(lane);
+				continue;
+			}
+
+			unsigned int size = ++lanesAt[pc[lane]];
+
+			if (size > groupSize || (size == groupSize && pc[lane] < groupPc)) {
+				groupPc = pc[lane];
+				groupSize = size;
+			}
+		}
+
+		if (!active) break;
+
+		if (groupSize) {
+			executed += runGroup(groupPc);
+		}
+
+		//Only lanes which never joined the group are still counted, at the pc they wait at
+		for (unsigned int lane = 0; lane < lanes; lane++) {
+			if (pc[lane] < CHIP8_MEMORY_SIZE) {
+				lanesAt[pc[lane]] = 0;
+			}
+		}
+	}
+
+	std::fill(selected.begin(), selected.end(), 1);
+	syncTimers(0, lanes);
+
+	return executed;
+}
+
+/*
+	Every CHIP8_LOCKSTEP_WINDOW steps (opcodes run on a group, idle loops
+	skipped on one), checks whether they covered at least a quarter of the
+	lanes on average. A step loops over the lanes while an instance only runs
+	its own instructions: 256 lanes of TANK (34 instructions a step), late
+	TETRIS (25) or late BLINKY (8) ran at a third to a half the speed of 256
+	Chip8 instances each running a frame in turn, PONG (51) and UFO (90) at
+	about the same, early TETRIS (124) and BLINKY (82) about twice as fast.
+
+	Creating the instances costs about as much as CHIP8_LOCKSTEP_SEPARATE_STEPS
+	steps lose on lanes that far apart, so separate() only runs once the
+	windows below a quarter added up to that many steps, and short runs which
+	diverge late never pay for it.
+*/
+void Chip8Lockstep::separateIfDiverged() {
+	if (windowSteps < CHIP8_LOCKSTEP_WINDOW) return;
+
+	if (windowInstructions * 4 < windowSteps * lanes) {
+		divergedSteps += windowSteps;
+	}
+
+	windowSteps = 0;
+	windowInstructions = 0;
+
+	if (divergedSteps >= CHIP8_LOCKSTEP_SEPARATE_STEPS) {
+		separate();
+	}
+}
+
+/*
+	Moves every lane to its own Chip8, which runs it on the block engine from
+	then on. Lanes whose pcs drifted apart (random numbers, different input)
+	rarely meet again, so they stay there. Lanes which already stopped keep
+	their error message in errorMessages.
+*/
+void Chip8Lockstep::separate() {
+	std::vector<std::unique_ptr<Chip8>> separated(lanes);
+	Chip8State laneState;
+
+	for (unsigned int lane = 0; lane < lanes; lane++) {
+		getState(lane, laneState);
+
+		separated[lane].reset(new Chip8());
+		separated[lane]->setCycles(cycles);
+		separated[lane]->loadState(laneState);
+	}
+
+	machines.swap(separated);
+}
+
+/*
+	Runs opcodes on every active lane at address at once, until their pcs
+	differ. Lanes waiting at a pc the group reaches join it, lanes which use
+	up their instructions leave it. The opcodes are counted once for the
+	whole group and only taken off remaining by settleSteps(), the group
+	stops for it when its lane with the fewest instructions left runs out.
+	Returns the number of instructions run over all lanes.
+*/
+unsigned long Chip8Lockstep::runGroup(unsigned int address) {
+	unsigned int begin = 0;
+	unsigned int end = 0;
+
+	unsigned int size = addLanes(address, begin, end);
+	unsigned long executed = 0;
+
+	while (size) {
+		//Lanes may hold different code at an address one of them wrote
+		if (written[address] || written[(address + 1) % CHIP8_MEMORY_SIZE]) {
+			settleSteps(begin, end);
+
+			for (unsigned int lane = begin; lane < end; lane++) {
+				if (selected[lane]) executed += stepLane(lane);
+			}
+
+			break;
+		}
+
+		const Instruction& ins = decodedAt(address);
+		unsigned long skipped = skipIdleLoop(ins, address, begin, end);
+		bool left = true;
+
+		if (skipped) {
+			executed += skipped;
+		} else {
+			bool diverged = (this->*ins.handler)(ins, begin, end);
+
+			executed += size;
+
+			windowSteps++;
+			windowInstructions += size;
+
+			if (size > 1) {
+				vectorSteps++;
+			} else {
+				scalarSteps++;
+			}
+
+			left = ++groupSteps == groupBudget;
+
+			if (diverged) break;
+
+			address = pc[begin];
+		}
+
+		if (left || lanesAt[address]) {
+			size = addLanes(address, begin, end);
+		}
+	}
+
+	settleSteps(begin, end);
+
+	return executed;
+}
+
+/*
+	Settles the steps of the group, then makes it every active lane at address
+	with instructions left, which keeps the lanes of the group (all at address
+	and still running) and adds the ones waiting there. Returns its size and
+	sets [begin, end) around it.
+*/
+unsigned int Chip8Lockstep::addLanes(unsigned int address, unsigned int& begin, unsigned int& end) {
+	uint8_t* group = selected.data();
+	const uint8_t* active = running.data();
+	uint32_t* left = remaining.data();
+	const uint16_t* pcs = pc.data();
+	const unsigned int count = lanes;
+	const uint32_t steps = groupSteps;
+	unsigned int size = 0;
+	uint32_t budget = UINT32_MAX;
+
+	for (unsigned int lane = 0; lane < count; lane++) {
+		uint32_t settled = left[lane] - steps * group[lane];
+		uint8_t member = active[lane] & (settled != 0) & (pcs[lane] == address);
+
+		left[lane] = settled;
+		group[lane] = member;
+		size += member;
+
+		//All ones for the lanes outside the group, so only the group counts
+		budget = std::min(budget, settled | (static_cast<uint32_t>(member) - 1));
+	}
+
+	groupSteps = 0;
+	groupBudget = budget;
+	lanesAt[address] = 0;
+
+	if (!size) return 0;
+
+	for (begin = 0; !selected[begin]; begin++) {}
+	for (end = lanes; !selected[end - 1]; end--) {}
+
+	return size;
+}
+
+//Takes the opcodes the group ran off remaining of its lanes in [begin, end). Timer ticks are left to syncTimers().
+void Chip8Lockstep::settleSteps(unsigned int begin, unsigned int end) {
+	if (!groupSteps) return;
+
+	const uint8_t* group = selected.data();
+	uint32_t* left = remaining.data();
+	const uint32_t steps = groupSteps;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		left[lane] -= steps * group[lane];
+	}
+
+	groupBudget -= steps;
+	groupSteps = 0;
+}
+
+/*
+	Only Fx07, Fx15, Fx18, the idle loops and getState() see the timers, so
+	instead of counting every instruction towards the next tick, each lane
+	catches up on the ticks of the instructions it ran since the last time
+	here. The result is the same as ticking after every instruction.
+*/
+void Chip8Lockstep::syncTimers(unsigned int begin, unsigned int end) {
+	settleSteps(begin, end);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (!selected[lane]) continue;
+
+		countInstructions(lane, countedRemaining[lane] - remaining[lane]);
+		countedRemaining[lane] = remaining[lane];
+	}
+}
+
+/*
+	Fast-forwards the selected lanes through a jump to itself, a delay timer
+	loop (see isDelayLoop()) or an Fx0A while none of them has a key down,
+	each one up to its next tick or the end of its instructions. Lanes which
+	use up their instructions leave the group. Returns the number of
+	instructions skipped over all lanes, 0 if the opcode at address has to run.
+*/
+unsigned long Chip8Lockstep::skipIdleLoop(const Instruction& ins, unsigned int address, unsigned int begin, unsigned int end) {
+	bool delay = ins.handler == &Chip8Lockstep::opGetDelayTimerValue;
+	bool wait = ins.handler == &Chip8Lockstep::opWaitKeyPress;
+
+	if (!delay && !wait && (ins.handler != &Chip8Lockstep::opJump || ins.nnn != address)) return 0;
+
+	syncTimers(begin, end);
+
+	if (delay && !isDelayLoop(address, begin, end)) return 0;
+
+	for (unsigned int lane = begin; lane < end && wait; lane++) {
+		if (selected[lane] && inputMask[lane]) return 0;
+	}
+
+	unsigned long skipped = 0;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (!selected[lane]) continue;
+
+		uint32_t budget = std::min(remaining[lane], instructionsUntilTick[lane]);
+
+		//The loop goes back to its first opcode, so every lane stays at address
+		if (delay) {
+			reg(ins.x)[lane] = delayTimer[lane];
+			budget -= budget % 3;
+		}
+
+		remaining[lane] -= budget;
+		countedRemaining[lane] = remaining[lane];
+		countInstructions(lane, budget);
+		skipped += budget;
+
+		if (!remaining[lane]) {
+			selected[lane] = 0;
+		}
+	}
+
+	windowSteps++;
+	windowInstructions += skipped;
+
+	return skipped;
+}
+
+/*
+	Fx07, 3x00, 1nnn back to the Fx07 on selected lanes whose delay timer is
+	not 0, which only loops until the next tick (see Chip8::skipIdleLoop()).
+	Each lane needs room for a whole round of the loop before its next tick.
+*/
+bool Chip8Lockstep::isDelayLoop(unsigned int address, unsigned int begin, unsigned int end) {
+	if (address + 6 > CHIP8_MEMORY_SIZE) return false;
+
+	for (unsigned int i = address; i < address + 6; i++) {
+		if (written[i]) return false;
+	}
+
+	const Instruction& first = decodedAt(address);
+	const Instruction& test = decodedAt(address + 2);
+	const Instruction& jump = decodedAt(address + 4);
+
+	if (first.handler != &Chip8Lockstep::opGetDelayTimerValue) return false;
+	if (test.handler != &Chip8Lockstep::opSkipIfEqual || test.x != first.x || test.kk != 0) return false;
+	if (jump.handler != &Chip8Lockstep::opJump || jump.nnn != address) return false;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (!selected[lane]) continue;
+
+		if (delayTimer[lane] == 0 || remaining[lane] < 3 || instructionsUntilTick[lane] < 3) return false;
+	}
+
+	return true;
+}
+
+//Runs the opcode at pc on one lane on its own, or skips its idle loop. Returns the number of instructions run.
+unsigned long Chip8Lockstep::stepLane(unsigned int lane) {
+	unsigned int address = pc[lane];
+
+	selected[lane] = 1;
+
+	if (address < CHIP8_MEMORY_SIZE && !written[address] && !written[(address + 1) % CHIP8_MEMORY_SIZE]) {
+		unsigned long skipped = skipIdleLoop(decodedAt(address), address, lane, lane + 1);
+
+		if (skipped) return skipped;
+	}
+
+	if (address >= CHIP8_MEMORY_SIZE) {
+		fail(lane, "Out of memory.");
+	} else if (written[address] || written[(address + 1) % CHIP8_MEMORY_SIZE]) {
+		const Instruction ins = decode(lane, address);
+		(this->*ins.handler)(ins, lane, lane + 1);
+	} else {
+		const Instruction& ins = decodedAt(address);
+		(this->*ins.handler)(ins, lane, lane + 1);
+	}
+
+	remaining[lane]--;
+
+	scalarSteps++;
+	windowSteps++;
+	windowInstructions++;
+
+	return 1;
+}
+
+//Same timer schedule as Chip8::countInstructions(), but for any number of instructions
+void Chip8Lockstep::countInstructions(unsigned int lane, unsigned long count) {
+	while (count >= instructionsUntilTick[lane]) {
+		count -= instructionsUntilTick[lane];
+		instructionsUntilTick[lane] = 0;
+
+		tickTimers(lane);
+	}
+
+	instructionsUntilTick[lane] -= count;
+}
+
+void Chip8Lockstep::tickTimers(unsigned int lane) {
+	while (instructionsUntilTick[lane] == 0) {
+		if (delayTimer[lane] > 0) {
+			delayTimer[lane]--;
+		}
+
+		if (soundTimer[lane] > 0) {
+			soundTimer[lane]--;
+		}
+
+		scheduleTick(lane);
+	}
+}
+
+void Chip8Lockstep::scheduleTick(unsigned int lane) {
+	tickCredit[lane] += cycles;
+
+	instructionsUntilTick[lane] = tickCredit[lane] / CHIP8_CLOCK_SPEED;
+	tickCredit[lane] %= CHIP8_CLOCK_SPEED;
+}
+
+Chip8Lockstep::Instruction Chip8Lockstep::decode(unsigned int lane, unsigned int address) const {
+	const uint8_t* laneMemory = &memory[lane * CHIP8_MEMORY_SIZE];
+
+	Instruction ins;
+
+	ins.opcode = laneMemory[address] << 8 | laneMemory[(address + 1) % CHIP8_MEMORY_SIZE];
+	ins.x = (ins.opcode & 0x0F00) >> 8;
+	ins.y = (ins.opcode & 0x00F0) >> 4;
+	ins.n = ins.opcode & 0x000F;
+	ins.kk = ins.opcode & 0x00FF;
+	ins.nnn = ins.opcode & 0x0FFF;
+
+	ins.handler = &Chip8Lockstep::unknownOpcode;
+
+	switch (ins.opcode >> 12) {
+		case 0x0:
+			if (ins.opcode == Chip8Opcodes::ClearScreen) ins.handler = &Chip8Lockstep::opClearScreen;
+			if (ins.opcode == Chip8Opcodes::Return) ins.handler = &Chip8Lockstep::opReturn;
+			break;
+		case 0x1: ins.handler = &Chip8Lockstep::opJump; break;
+		case 0x2: ins.handler = &Chip8Lockstep::opSubroutineCall; break;
+		case 0x3: ins.handler = &Chip8Lockstep::opSkipIfEqual; break;
+		case 0x4: ins.handler = &Chip8Lockstep::opSkipIfNotEqual; break;
+		case 0x5: ins.handler = &Chip8Lockstep::opSkipIfRegistersEqual; break;
+		case 0x6: ins.handler = &Chip8Lockstep::opSetRegister; break;
+		case 0x7: ins.handler = &Chip8Lockstep::opRegisterAdd; break;
+		case 0x8:
+			switch (ins.n) {
+				case 0x0: ins.handler = &Chip8Lockstep::opAssignRegisters; break;
+				case 0x1: ins.handler = &Chip8Lockstep::opBitwiseOr; break;
+				case 0x2: ins.handler = &Chip8Lockstep::opBitwiseAnd; break;
+				case 0x3: ins.handler = &Chip8Lockstep::opBitwiseXor; break;
+				case 0x4: ins.handler = &Chip8Lockstep::opAddRegisterAndSetCarry; break;
+				case 0x5: ins.handler = &Chip8Lockstep::opSubtractRegisterAndSetCarry; break;
+				case 0x6: ins.handler = &Chip8Lockstep::opDivideLSB; break;
+				case 0x7: ins.handler = &Chip8Lockstep::opSubtractRegisterAndSetCarryYX; break;
+				case 0xE: ins.handler = &Chip8Lockstep::opMultiplyMSB; break;
+			}
+			break;
+		case 0x9: ins.handler = &Chip8Lockstep::opSkipIfRegistersNotEqual; break;
+		case 0xA: ins.handler = &Chip8Lockstep::opSetIndexRegister; break;
+		case 0xB: ins.handler = &Chip8Lockstep::opSetProgramCounterPlusV0; break;
+		case 0xC: ins.handler = &Chip8Lockstep::opGenRandom; break;
+		case 0xD: ins.handler = &Chip8Lockstep::opDrawSprite; break;
+		case 0xE:
+			if (ins.kk == (Chip8Opcodes::SkipIfKeyIsPressed & 0xFF)) ins.handler = &Chip8Lockstep::opSkipIfKeyIsPressed;
+			if (ins.kk == (Chip8Opcodes::SkipIfKeyIsNotPressed & 0xFF)) ins.handler = &Chip8Lockstep::opSkipIfKeyIsNotPressed;
+			break;
+		case 0xF:
+			switch (ins.kk) {
+				case Chip8Opcodes::GetDelayTimerValue & 0xFF: ins.handler = &Chip8Lockstep::opGetDelayTimerValue; break;
+				case Chip8Opcodes::WaitKeyPress & 0xFF: ins.handler = &Chip8Lockstep::opWaitKeyPress; break;
+				case Chip8Opcodes::SetDelayTimer & 0xFF: ins.handler = &Chip8Lockstep::opSetDelayTimer; break;
+				case Chip8Opcodes::SetSoundTimer & 0xFF: ins.handler = &Chip8Lockstep::opSetSoundTimer; break;
+				case Chip8Opcodes::IndexAdd & 0xFF: ins.handler = &Chip8Lockstep::opIndexAdd; break;
+				case Chip8Opcodes::IndexSetFont & 0xFF: ins.handler = &Chip8Lockstep::opIndexSetFont; break;
+				case Chip8Opcodes::IndexBCD & 0xFF: ins.handler = &Chip8Lockstep::opIndexBCD; break;
+				case Chip8Opcodes::RegistersToMemory & 0xFF: ins.handler = &Chip8Lockstep::opRegistersToMemory; break;
+				case Chip8Opcodes::MemoryToRegisters & 0xFF: ins.handler = &Chip8Lockstep::opMemoryToRegisters; break;
+			}
+			break;
+	}
+
+	return ins;
+}
+
+//Addresses no lane wrote hold the same bytes in every lane, so lane 0 decodes them for all
+const Chip8Lockstep::Instruction& Chip8Lockstep::decodedAt(unsigned int address) {
+	Instruction& ins = decoded[address];
+
+	if (!ins.handler) {
+		ins = decode(0, address);
+	}
+
+	return ins;
+}
+
+void Chip8Lockstep::fail(unsigned int lane, const std::string& message) {
+	running[lane] = 0;
+	error[lane] = 1;
+
+	errorMessages[lane] = message;
+}
+
+void Chip8Lockstep::markWritten(unsigned int address) {
+	written[address % CHIP8_MEMORY_SIZE] = true;
+}
+
+uint8_t* Chip8Lockstep::reg(unsigned int v) {
+	return &registers[v * lanes];
+}
+
+//Lanes stop like Chip8::advance() when they run past the end of memory
+bool Chip8Lockstep::advance(unsigned int begin, unsigned int end, int a) {
+	const uint8_t* group = selected.data();
+	uint16_t* pcs = pc.data();
+	unsigned int overflow = 0;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		pcs[lane] += group[lane] ? a : 0;
+		overflow |= group[lane] & (pcs[lane] >= CHIP8_MEMORY_SIZE);
+	}
+
+	if (!overflow) return false;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (group[lane] && pcs[lane] >= CHIP8_MEMORY_SIZE) fail(lane, "Out of memory.");
+	}
+
+	return true;
+}
+
+//Skips the next opcode on the lanes whose condition is set
+bool Chip8Lockstep::skip(unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint16_t* pcs = pc.data();
+	const uint8_t* conditions = condition.data();
+	unsigned int size = 0;
+	unsigned int taken = 0;
+	unsigned int overflow = 0;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		pcs[lane] += group[lane] ? (conditions[lane] ? 4 : 2) : 0;
+		size += group[lane];
+		taken += group[lane] & conditions[lane];
+		overflow |= group[lane] & (pcs[lane] >= CHIP8_MEMORY_SIZE);
+	}
+
+	if (overflow) {
+		for (unsigned int lane = begin; lane < end; lane++) {
+			if (group[lane] && pcs[lane] >= CHIP8_MEMORY_SIZE) fail(lane, "Out of memory.");
+		}
+	}
+
+	return overflow || (taken != 0 && taken != size);
+}
+
+/*
+	Opcodes, each one mirroring its handler in Chip8.cpp statement by statement.
+	A statement is a loop over the lanes, so where a register is both read and
+	written (e.g. VF as x or y) every lane sees the same order as Chip8.
+	Lanes of [begin, end) outside the group keep their values, the simple
+	statements select between the old and the new value instead of branching,
+	so they still vectorize.
+*/
+
+bool Chip8Lockstep::opClearScreen(const Instruction& /*ins*/, unsigned int begin, unsigned int end) {
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (!selected[lane]) continue;
+
+		std::fill(&screen[lane * CHIP8_SCREEN_HEIGHT], &screen[lane * CHIP8_SCREEN_HEIGHT] + CHIP8_SCREEN_HEIGHT, 0);
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opReturn(const Instruction& /*ins*/, unsigned int begin, unsigned int end) {
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (!selected[lane]) continue;
+
+		if (sp[lane] == 0) {
+			fail(lane, "Stack underflow.");
+			continue;
+		}
+
+		pc[lane] = stack[lane * CHIP8_STACK_SIZE + --sp[lane]];
+	}
+
+	advance(begin, end, 2);
+
+	return true;
+}
+
+bool Chip8Lockstep::opJump(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint16_t* pcs = pc.data();
+	const uint16_t nnn = ins.nnn;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		pcs[lane] = group[lane] ? nnn : pcs[lane];
+	}
+
+	return false;
+}
+
+bool Chip8Lockstep::opSubroutineCall(const Instruction& ins, unsigned int begin, unsigned int end) {
+	bool stopped = false;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (!selected[lane]) continue;
+
+		if (sp[lane] >= CHIP8_STACK_SIZE) {
+			fail(lane, "Stack overflow.");
+			stopped = true;
+		} else {
+			stack[lane * CHIP8_STACK_SIZE + sp[lane]++] = pc[lane];
+		}
+
+		pc[lane] = ins.nnn;
+	}
+
+	return stopped;
+}
+
+bool Chip8Lockstep::opSkipIfEqual(const Instruction& ins, unsigned int begin, unsigned int end) {
+	uint8_t* conditions = condition.data();
+	const uint8_t* vx = reg(ins.x);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		conditions[lane] = vx[lane] == ins.kk;
+	}
+
+	return skip(begin, end);
+}
+
+bool Chip8Lockstep::opSkipIfNotEqual(const Instruction& ins, unsigned int begin, unsigned int end) {
+	uint8_t* conditions = condition.data();
+	const uint8_t* vx = reg(ins.x);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		conditions[lane] = vx[lane] != ins.kk;
+	}
+
+	return skip(begin, end);
+}
+
+bool Chip8Lockstep::opSkipIfRegistersEqual(const Instruction& ins, unsigned int begin, unsigned int end) {
+	uint8_t* conditions = condition.data();
+	const uint8_t* vx = reg(ins.x);
+	const uint8_t* vy = reg(ins.y);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		conditions[lane] = vx[lane] == vy[lane];
+	}
+
+	return skip(begin, end);
+}
+
+bool Chip8Lockstep::opSetRegister(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* vx = reg(ins.x);
+	const uint8_t kk = ins.kk;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		vx[lane] = group[lane] ? kk : vx[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opRegisterAdd(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* vx = reg(ins.x);
+	const uint8_t kk = ins.kk;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t sum = vx[lane] + kk;
+		vx[lane] = group[lane] ? sum : vx[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opAssignRegisters(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* vx = reg(ins.x);
+	const uint8_t* vy = reg(ins.y);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t value = vy[lane];
+		vx[lane] = group[lane] ? value : vx[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opBitwiseOr(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* vx = reg(ins.x);
+	const uint8_t* vy = reg(ins.y);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t value = vx[lane] | vy[lane];
+		vx[lane] = group[lane] ? value : vx[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opBitwiseAnd(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* vx = reg(ins.x);
+	const uint8_t* vy = reg(ins.y);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t value = vx[lane] & vy[lane];
+		vx[lane] = group[lane] ? value : vx[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opBitwiseXor(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* vx = reg(ins.x);
+	const uint8_t* vy = reg(ins.y);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t value = vx[lane] ^ vy[lane];
+		vx[lane] = group[lane] ? value : vx[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opAddRegisterAndSetCarry(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* vx = reg(ins.x);
+	const uint8_t* vy = reg(ins.y);
+	uint8_t* vf = reg(CARRY_REGISTER);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t carry = vx[lane] + vy[lane] > 255 ? 1 : 0;
+		vf[lane] = group[lane] ? carry : vf[lane];
+	}
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t sum = vx[lane] + vy[lane];
+		vx[lane] = group[lane] ? sum : vx[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opSubtractRegisterAndSetCarry(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* vx = reg(ins.x);
+	const uint8_t* vy = reg(ins.y);
+	uint8_t* vf = reg(CARRY_REGISTER);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t carry = vx[lane] > vy[lane] ? 1 : 0;
+		vf[lane] = group[lane] ? carry : vf[lane];
+	}
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t difference = vx[lane] - vy[lane];
+		vx[lane] = group[lane] ? difference : vx[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opDivideLSB(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* vx = reg(ins.x);
+	uint8_t* vf = reg(CARRY_REGISTER);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t carry = vx[lane] & 0x1;
+		vf[lane] = group[lane] ? carry : vf[lane];
+	}
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t value = vx[lane] >> 1;
+		vx[lane] = group[lane] ? value : vx[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opSubtractRegisterAndSetCarryYX(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* vx = reg(ins.x);
+	const uint8_t* vy = reg(ins.y);
+	uint8_t* vf = reg(CARRY_REGISTER);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t difference = vy[lane] - vx[lane];
+		vx[lane] = group[lane] ? difference : vx[lane];
+	}
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t carry = vy[lane] > vx[lane] ? 1 : 0;
+		vf[lane] = group[lane] ? carry : vf[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opMultiplyMSB(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* vx = reg(ins.x);
+	uint8_t* vf = reg(CARRY_REGISTER);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t carry = vx[lane] >> 7;
+		vf[lane] = group[lane] ? carry : vf[lane];
+	}
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t value = vx[lane] << 1;
+		vx[lane] = group[lane] ? value : vx[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opSkipIfRegistersNotEqual(const Instruction& ins, unsigned int begin, unsigned int end) {
+	uint8_t* conditions = condition.data();
+	const uint8_t* vx = reg(ins.x);
+	const uint8_t* vy = reg(ins.y);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		conditions[lane] = vx[lane] != vy[lane];
+	}
+
+	return skip(begin, end);
+}
+
+bool Chip8Lockstep::opSetIndexRegister(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint16_t* indexes = indexRegister.data();
+	const uint16_t nnn = ins.nnn;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		indexes[lane] = group[lane] ? nnn : indexes[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opSetProgramCounterPlusV0(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint16_t* pcs = pc.data();
+	const uint8_t* v0 = reg(0);
+	const uint16_t nnn = ins.nnn;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint16_t target = nnn + v0[lane];
+		pcs[lane] = group[lane] ? target : pcs[lane];
+	}
+
+	return true;
+}
+
+bool Chip8Lockstep::opGenRandom(const Instruction& ins, unsigned int begin, unsigned int end) {
+	uint8_t* vx = reg(ins.x);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (!selected[lane]) continue;
+
+		vx[lane] = chip8NextRandom(randomState[lane]) & ins.kk;
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opDrawSprite(const Instruction& ins, unsigned int begin, unsigned int end) {
+	uint8_t* vf = reg(CARRY_REGISTER);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (!selected[lane]) continue;
+
+		unsigned int x = reg(ins.x)[lane] % CHIP8_SCREEN_WIDTH;
+		unsigned int y = reg(ins.y)[lane];
+
+		const uint8_t* laneMemory = &memory[lane * CHIP8_MEMORY_SIZE];
+		uint64_t* laneScreen = &screen[lane * CHIP8_SCREEN_HEIGHT];
+
+		bool erased = false;
+
+		for (int i = 0; i < ins.n; ++i) {
+			uint64_t sprite = static_cast<uint64_t>(laneMemory[(indexRegister[lane] + i) & 0x0FFF]) << (CHIP8_SCREEN_WIDTH - 8);
+
+			if (x) {
+				sprite = sprite >> x | sprite << (CHIP8_SCREEN_WIDTH - x);
+			}
+
+			uint64_t& row = laneScreen[(y + i) % CHIP8_SCREEN_HEIGHT];
+
+			if (row & sprite) erased = true;
+
+			row ^= sprite;
+		}
+
+		vf[lane] = erased ? 1 : 0;
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opSkipIfKeyIsPressed(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint16_t* keys = inputMask.data();
+	uint8_t* conditions = condition.data();
+	const uint8_t* vx = reg(ins.x);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		conditions[lane] = (keys[lane] & (1 << (vx[lane] & 0xF))) != 0;
+	}
+
+	return skip(begin, end);
+}
+
+bool Chip8Lockstep::opSkipIfKeyIsNotPressed(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint16_t* keys = inputMask.data();
+	uint8_t* conditions = condition.data();
+	const uint8_t* vx = reg(ins.x);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		conditions[lane] = (keys[lane] & (1 << (vx[lane] & 0xF))) == 0;
+	}
+
+	return skip(begin, end);
+}
+
+bool Chip8Lockstep::opGetDelayTimerValue(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	const uint8_t* delays = delayTimer.data();
+	uint8_t* vx = reg(ins.x);
+
+	syncTimers(begin, end);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t value = delays[lane];
+		vx[lane] = group[lane] ? value : vx[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+//Lanes without a key down stay at this opcode
+bool Chip8Lockstep::opWaitKeyPress(const Instruction& ins, unsigned int begin, unsigned int end) {
+	uint8_t* vx = reg(ins.x);
+	unsigned int size = 0;
+	unsigned int pressed = 0;
+	bool stopped = false;
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (!selected[lane]) continue;
+
+		size++;
+
+		for (unsigned int key = 0; key < CHIP8_KBD_SIZE; ++key) {
+			if (inputMask[lane] & (1 << key)) {
+				vx[lane] = key;
+				pressed++;
+
+				stopped = advance(lane, lane + 1, 2) || stopped;
+				break;
+			}
+		}
+	}
+
+	return stopped || (pressed != 0 && pressed != size);
+}
+
+bool Chip8Lockstep::opSetDelayTimer(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* delays = delayTimer.data();
+	const uint8_t* vx = reg(ins.x);
+
+	syncTimers(begin, end);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t value = vx[lane];
+		delays[lane] = group[lane] ? value : delays[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opSetSoundTimer(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint8_t* sounds = soundTimer.data();
+	const uint8_t* vx = reg(ins.x);
+
+	syncTimers(begin, end);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint8_t value = vx[lane];
+		sounds[lane] = group[lane] ? value : sounds[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opIndexAdd(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint16_t* indexes = indexRegister.data();
+	const uint8_t* vx = reg(ins.x);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint16_t sum = indexes[lane] + vx[lane];
+		indexes[lane] = group[lane] ? sum : indexes[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opIndexSetFont(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* group = selected.data();
+	uint16_t* indexes = indexRegister.data();
+	const uint8_t* vx = reg(ins.x);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		uint16_t font = vx[lane] * 0x5;
+		indexes[lane] = group[lane] ? font : indexes[lane];
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opIndexBCD(const Instruction& ins, unsigned int begin, unsigned int end) {
+	const uint8_t* vx = reg(ins.x);
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (!selected[lane]) continue;
+
+		uint8_t* laneMemory = &memory[lane * CHIP8_MEMORY_SIZE];
+		unsigned int val = vx[lane];
+
+		laneMemory[indexRegister[lane] & 0x0FFF] = val / 100;
+		laneMemory[(indexRegister[lane] + 1) & 0x0FFF] = (val / 10) % 10;
+		laneMemory[(indexRegister[lane] + 2) & 0x0FFF] = val % 10;
+
+		for (int i = 0; i < 3; i++) {
+			markWritten(indexRegister[lane] + i);
+		}
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opRegistersToMemory(const Instruction& ins, unsigned int begin, unsigned int end) {
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (!selected[lane]) continue;
+
+		uint8_t* laneMemory = &memory[lane * CHIP8_MEMORY_SIZE];
+
+		for (unsigned int i = 0; i <= ins.x; i++) {
+			laneMemory[(indexRegister[lane] + i) & 0x0FFF] = reg(i)[lane];
+			markWritten(indexRegister[lane] + i);
+		}
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::opMemoryToRegisters(const Instruction& ins, unsigned int begin, unsigned int end) {
+	for (unsigned int i = 0; i <= ins.x; i++) {
+		uint8_t* vi = reg(i);
+
+		for (unsigned int lane = begin; lane < end; lane++) {
+			if (!selected[lane]) continue;
+
+			vi[lane] = memory[lane * CHIP8_MEMORY_SIZE + ((indexRegister[lane] + i) & 0x0FFF)];
+		}
+	}
+
+	return advance(begin, end, 2);
+}
+
+bool Chip8Lockstep::unknownOpcode(const Instruction& ins, unsigned int begin, unsigned int end) {
+	std::stringstream ss;
+
+	ss << "Unknown opcode: 0x" << std::hex << std::uppercase << ins.opcode << "\n";
+
+	for (unsigned int lane = begin; lane < end; lane++) {
+		if (selected[lane]) fail(lane, ss.str());
+	}
+
+	return true;
+}
+
+unsigned int Chip8Lockstep::getLaneCount() const {
+	return lanes;
+}
+
+void Chip8Lockstep::getState(unsigned int lane, Chip8State& out) const {
+	if (!machines.empty()) {
+		machines[lane]->saveState(out);
+		return;
+	}
+
+	std::memcpy(out.memory.data(), &memory[lane * CHIP8_MEMORY_SIZE], CHIP8_MEMORY_SIZE);
+	std::copy(&screen[lane * CHIP8_SCREEN_HEIGHT], &screen[lane * CHIP8_SCREEN_HEIGHT] + CHIP8_SCREEN_HEIGHT, out.screen.begin());
+	std::copy(&stack[lane * CHIP8_STACK_SIZE], &stack[lane * CHIP8_STACK_SIZE] + CHIP8_STACK_SIZE, out.stack.begin());
+
+	for (unsigned int v = 0; v < CHIP8_REGISTERS; v++) {
+		out.registers[v] = registers[v * lanes + lane];
+	}
+
+	out.indexRegister = indexRegister[lane];
+	out.pc = pc[lane];
+	out.sp = sp[lane];
+	out.inputMask = inputMask[lane];
+	out.delayTimer = delayTimer[lane];
+	out.soundTimer = soundTimer[lane];
+	out.running = running[lane] != 0;
+	out.error = error[lane] != 0;
+	out.instructionsUntilTick = instructionsUntilTick[lane];
+	out.tickCredit = tickCredit[lane];
+	out.instructionCredit = instructionCredit[lane];
+	out.randomState = randomState[lane];
+}
+
+void Chip8Lockstep::setState(unsigned int lane, const Chip8State& in) {
+	if (!machines.empty()) {
+		machines[lane]->loadState(in);
+		errorMessages[lane].clear();
+		return;
+	}
+
+	std::memcpy(&memory[lane * CHIP8_MEMORY_SIZE], in.memory.data(), CHIP8_MEMORY_SIZE);
+	std::copy(in.screen.begin(), in.screen.end(), &screen[lane * CHIP8_SCREEN_HEIGHT]);
+	std::copy(in.stack.begin(), in.stack.end(), &stack[lane * CHIP8_STACK_SIZE]);
+
+	for (unsigned int v = 0; v < CHIP8_REGISTERS; v++) {
+		registers[v * lanes + lane] = in.registers[v];
+	}
+
+	indexRegister[lane] = in.indexRegister;
+	pc[lane] = in.pc;
+	sp[lane] = in.sp;
+	inputMask[lane] = in.inputMask;
+	delayTimer[lane] = in.delayTimer;
+	soundTimer[lane] = in.soundTimer;
+	running[lane] = in.running;
+	error[lane] = in.error;
+	instructionsUntilTick[lane] = in.instructionsUntilTick;
+	tickCredit[lane] = in.tickCredit;
+	instructionCredit[lane] = in.instructionCredit;
+	randomState[lane] = in.randomState;
+
+	//Bytes that now differ between lanes can no longer be decoded once for all
+	for (unsigned int other = 0; other < lanes; other++) {
+		for (unsigned int address = 0; address < CHIP8_MEMORY_SIZE; address++) {
+			if (memory[other * CHIP8_MEMORY_SIZE + address] != in.memory[address]) {
+				markWritten(address);
+			}
+		}
+	}
+
+	for (auto& ins : decoded) {
+		ins.handler = nullptr;
+	}
+}
+
+const std::string& Chip8Lockstep::getErrorMessage(unsigned int lane) const {
+	if (!machines.empty() && errorMessages[lane].empty()) {
+		return machines[lane]->getErrorMessage();
+	}
+
+	return errorMessages[lane];
+}
+
+unsigned long Chip8Lockstep::getVectorSteps() const {
+	return vectorSteps;
+}
+
+unsigned long Chip8Lockstep::getScalarSteps() const {
+	return scalarSteps;
+}
+
+unsigned long Chip8Lockstep::getSeparateInstructions() const {
+	return separateInstructions;
+}
@@ -0,0 +1,208 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef CHIP8LOCKSTEP_H
+#define CHIP8LOCKSTEP_H
+
+#include "Chip8.h"
+
+const unsigned long CHIP8_LOCKSTEP_WINDOW = 1024; //steps between two checks that the lanes still share their pcs
+const unsigned long CHIP8_LOCKSTEP_SEPARATE_STEPS = 65536; //steps on lanes gone apart before they move to separate Chip8 instances
+
+/*
+	Runs many instances of one ROM together, e.g. with different seeds or inputs.
+
+	The state is stored as structure of arrays: every register, pc, I, sp and
+	timer is an array with one lane per instance, so an opcode applied to many
+	lanes is a loop over contiguous arrays which the compiler turns into SSE or
+	AVX2 code (the Visual Studio project builds this file alone with
+	/arch:AVX2, so the rest of the emulator runs on any x86 CPU; add -mavx2 or
+	-march=native for it with GCC). Memory, stack and screen are per lane
+	blocks, since they are indexed by per lane values.
+
+	Lanes at the same pc form a group: each opcode is decoded once and run on
+	all lanes of the group at once, with a mask selecting them so that the
+	other lanes keep their values. When a skip or a random number sends the
+	lanes different ways, the largest group runs next, and lanes meeting at a
+	pc join the same group again. Each lane behaves exactly like a Chip8
+	running on its own, timers included.
+
+	An opcode costs a loop over the lanes whether its group holds all of them
+	or a few, so this only pays off while most lanes share their pc. Every
+	CHIP8_LOCKSTEP_WINDOW steps the average group size is checked, and after
+	CHIP8_LOCKSTEP_SEPARATE_STEPS steps in windows below a quarter of the
+	lanes, every lane moves to its own Chip8 on the block engine for good
+	(see separateIfDiverged()).
+*/
+class Chip8Lockstep {
+public:
+	explicit Chip8Lockstep(unsigned int lanes);
+
+	void loadFromMemory(const uint8_t* rom, std::size_t size); //into every lane, like Chip8::loadFromMemory() and prepare()
+
+	void setCycles(int perSecond);
+	void seedRandom(unsigned int lane, uint64_t seed);
+	void setKeys(unsigned int lane, uint16_t keys); //bit n is set while key n is down
+
+	unsigned long execute(unsigned long maxInstructions); //runs each lane for up to maxInstructions, returns the total over all lanes
+	unsigned long runFrame(); //one emulated frame on every lane, see Chip8::runFrame()
+
+	unsigned int getLaneCount() const;
+	void getState(unsigned int lane, Chip8State& out) const;
+	void setState(unsigned int lane, const Chip8State& in);
+	const std::string& getErrorMessage(unsigned int lane) const;
+
+	unsigned long getVectorSteps() const; //opcodes run on a group of lanes at once
+	unsigned long getScalarSteps() const; //opcodes run on a single lane
+	unsigned long getSeparateInstructions() const; //run by the Chip8 of each lane after separate()
+private:
+	struct Instruction;
+
+	//Runs the opcode on the selected lanes of [begin, end), which all have the same pc.
+	//Returns true if their pcs may differ afterwards or one of them stopped.
+	typedef bool (Chip8Lockstep::*Handler)(const Instruction& ins, unsigned int begin, unsigned int end);
+
+	struct Instruction {
+		Handler handler; //nullptr if the entry has not been decoded yet
+		Opcode opcode;
+		uint8_t x;
+		uint8_t y;
+		uint8_t n;
+		uint8_t kk;
+		uint16_t nnn;
+	};
+
+	Instruction decode(unsigned int lane, unsigned int address) const;
+	const Instruction& decodedAt(unsigned int address); //cached entry, valid while no lane wrote the address
+
+	unsigned long run(); //until every lane used up its remaining instructions or stopped
+	void separateIfDiverged();
+	void separate();
+	unsigned long runGroup(unsigned int address);
+	unsigned int addLanes(unsigned int address, unsigned int& begin, unsigned int& end);
+	void settleSteps(unsigned int begin, unsigned int end);
+	void syncTimers(unsigned int begin, unsigned int end);
+	unsigned long skipIdleLoop(const Instruction& ins, unsigned int address, unsigned int begin, unsigned int end);
+	bool isDelayLoop(unsigned int address, unsigned int begin, unsigned int end);
+	unsigned long stepLane(unsigned int lane);
+	void countInstructions(unsigned int lane, unsigned long count);
+	void tickTimers(unsigned int lane);
+	void scheduleTick(unsigned int lane);
+
+	void fail(unsigned int lane, const std::string& message);
+	void markWritten(unsigned int address);
+
+	bool opClearScreen(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opReturn(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opJump(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSubroutineCall(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSkipIfEqual(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSkipIfNotEqual(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSkipIfRegistersEqual(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSetRegister(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opRegisterAdd(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opAssignRegisters(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opBitwiseOr(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opBitwiseAnd(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opBitwiseXor(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opAddRegisterAndSetCarry(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSubtractRegisterAndSetCarry(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opDivideLSB(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSubtractRegisterAndSetCarryYX(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opMultiplyMSB(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSkipIfRegistersNotEqual(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSetIndexRegister(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSetProgramCounterPlusV0(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opGenRandom(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opDrawSprite(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSkipIfKeyIsPressed(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSkipIfKeyIsNotPressed(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opGetDelayTimerValue(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opWaitKeyPress(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSetDelayTimer(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opSetSoundTimer(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opIndexAdd(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opIndexSetFont(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opIndexBCD(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opRegistersToMemory(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool opMemoryToRegisters(const Instruction& ins, unsigned int begin, unsigned int end);
+	bool unknownOpcode(const Instruction& ins, unsigned int begin, unsigned int end);
+
+	bool advance(unsigned int begin, unsigned int end, int a);
+	bool skip(unsigned int begin, unsigned int end);
+
+	uint8_t* reg(unsigned int v); //lanes of register Vv
+
+	unsigned int lanes;
+
+	std::vector<uint8_t> registers; //[v * lanes + lane]
+	std::vector<uint16_t> pc;
+	std::vector<uint16_t> indexRegister;
+	std::vector<uint16_t> sp;
+	std::vector<uint16_t> inputMask;
+	std::vector<uint8_t> delayTimer;
+	std::vector<uint8_t> soundTimer;
+	std::vector<uint8_t> running;
+	std::vector<uint8_t> error;
+	std::vector<uint8_t> condition; //per lane result of a skip test
+	std::vector<uint8_t> selected; //1 for the lanes of the group being run
+
+	std::vector<uint32_t> instructionsUntilTick;
+	std::vector<uint32_t> tickCredit;
+	std::vector<uint32_t> instructionCredit;
+	std::vector<uint64_t> randomState; //Cxkk generator of each lane, see chip8NextRandom()
+	std::vector<uint32_t> remaining; //instructions left in the current execute() or frame
+	std::vector<uint32_t> countedRemaining; //remaining when the timers of the lane were last brought up to date
+
+	std::vector<uint8_t> memory; //[lane * CHIP8_MEMORY_SIZE + address]
+	std::vector<uint16_t> stack; //[lane * CHIP8_STACK_SIZE + level]
+	std::vector<uint64_t> screen; //[lane * CHIP8_SCREEN_HEIGHT + row]
+
+	std::vector<std::string> errorMessages;
+
+	std::vector<std::unique_ptr<Chip8>> machines; //one per lane once the lanes run separately, empty before
+
+	std::vector<unsigned int> lanesAt; //active lanes waiting per pc while a group is picked and run, 0 otherwise
+	uint32_t groupSteps; //opcodes the group ran which are not taken off remaining yet
+	uint32_t groupBudget; //smallest remaining in the group when it was last settled
+
+	std::array<Instruction, CHIP8_MEMORY_SIZE> decoded;
+	std::bitset<CHIP8_MEMORY_SIZE> written; //addresses any lane wrote, lanes may hold different code there
+
+	int cycles;
+
+	unsigned long vectorSteps;
+	unsigned long scalarSteps;
+	unsigned long separateInstructions;
+
+	unsigned long windowSteps; //opcodes run and idle loops skipped since the last check in separateIfDiverged()
+	unsigned long windowInstructions; //instructions run or skipped by them over all lanes
+	unsigned long divergedSteps; //steps of the windows below a quarter of the lanes
+};
+
+#endif
@@ -0,0 +1,455 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "Chip8Memo.h"
+#include <algorithm>
+
+const unsigned int CELL_MEMORY = 0;
+const unsigned int CELL_SCREEN = CELL_MEMORY + CHIP8_MEMORY_SIZE;
+const unsigned int CELL_STACK = CELL_SCREEN + CHIP8_SCREEN_HEIGHT;
+const unsigned int CELL_REGISTERS = CELL_STACK + CHIP8_STACK_SIZE;
+const unsigned int CELL_INDEX = CELL_REGISTERS + CHIP8_REGISTERS;
+const unsigned int CELL_KEYS = CELL_INDEX + 1;
+
+Chip8Memo::Chip8Memo(Chip8& target) : chip8(target), subroutines(CHIP8_MEMORY_SIZE, Subroutine()) {
+	hits = 0;
+	skippedInstructions = 0;
+	stale = false;
+
+	windowInstructions = 0;
+	windowSkipped = 0;
+	blockInstructions = 0;
+	blockRun = CHIP8_MEMO_WINDOW;
+
+	chip8.codeListener = this;
+}
+
+Chip8Memo::~Chip8Memo() {
+	chip8.codeListener = nullptr;
+}
+
+unsigned long Chip8Memo::execute(unsigned long maxInstructions) {
+	unsigned long executed = 0;
+	bool entered = false;
+
+	while (chip8.state.running && executed < maxInstructions) {
+		if (blockInstructions) {
+			unsigned long ran = chip8.executeBlocks(std::min(maxInstructions - executed, blockInstructions));
+
+			blockInstructions -= ran;
+			executed += ran;
+			entered = false;
+			continue;
+		}
+
+		//A window ends after the block or call that crosses it, so no call is cut short to fit
+		if (windowInstructions >= CHIP8_MEMO_WINDOW) {
+			if ((skippedInstructions - windowSkipped) * 2 < windowInstructions) {
+				blockInstructions = blockRun;
+				blockRun = std::min(blockRun * 2, CHIP8_MEMO_MAX_BLOCKS);
+			} else {
+				blockRun = CHIP8_MEMO_WINDOW;
+			}
+
+			windowInstructions = 0;
+			windowSkipped = skippedInstructions;
+			continue;
+		}
+
+		if (stale) {
+			clear();
+		}
+
+		if (entered) {
+			entered = false;
+
+			unsigned long ran = enter(maxInstructions - executed);
+
+			if (ran) {
+				executed += ran;
+				windowInstructions += ran;
+				continue;
+			}
+		}
+
+		//Timers tick between runs, like in Chip8::executeBlocks()
+		unsigned long slice = std::min<unsigned long>(maxInstructions - executed, chip8.state.instructionsUntilTick);
+		unsigned long ran = chip8.state.pc < CHIP8_MEMORY_SIZE && chip8.cache->idleCandidates[chip8.state.pc] ? chip8.skipIdleLoop(slice) : 0;
+
+		if (ran) {
+			executed += ran;
+			windowInstructions += ran;
+			chip8.countInstructions(ran);
+			continue;
+		}
+
+		//Blocks end at a 2nnn, so the stack grows exactly when a subroutine was just entered
+		uint16_t sp = chip8.state.sp;
+
+		ran = chip8.runBlock(slice);
+		executed += ran;
+		windowInstructions += ran;
+		chip8.countInstructions(ran);
+
+		entered = chip8.state.sp > sp && chip8.state.pc < CHIP8_MEMORY_SIZE && !rejected[chip8.state.pc];
+	}
+
+	return executed;
+}
+
+/*
+	Called with pc at the first instruction of a subroutine. Applies a
+	recorded result if one matches, otherwise records the call once the
+	subroutine is hot. Returns the number of instructions run or skipped,
+	0 to leave it to the block engine.
+*/
+unsigned long Chip8Memo::enter(unsigned long maxInstructions) {
+	Subroutine& subroutine = subroutines[chip8.state.pc];
+
+	subroutine.calls++;
+
+	for (const Result& result : subroutine.results) {
+		if (result.sp != chip8.state.sp || result.instructions > maxInstructions) continue;
+
+		bool same = true;
+
+		for (const Cell& cell : result.reads) {
+			if (load(cell.location) != cell.value) {
+				same = false;
+				break;
+			}
+		}
+
+		if (!same) continue;
+
+		for (const Cell& cell : result.writes) {
+			store(cell.location, cell.value);
+		}
+
+		//The return address was one of the reads, so it is the same as when recorded
+		chip8.state.sp--;
+		chip8.state.pc = chip8.state.stack[chip8.state.sp] + 2;
+
+		//Nothing the call did depends on the timers, so they tick as if it had run
+		unsigned long left = result.instructions;
+
+		while (left) {
+			unsigned long count = std::min<unsigned long>(left, chip8.state.instructionsUntilTick);
+			chip8.countInstructions(count);
+			left -= count;
+		}
+
+		subroutine.hits++;
+		hits++;
+		skippedInstructions += result.instructions;
+
+		return result.instructions;
+	}
+
+	if (subroutine.calls >= CHIP8_MEMO_TRIAL_CALLS && subroutine.hits * 4 < subroutine.calls) {
+		reject(chip8.state.pc);
+		return 0;
+	}
+
+	if (subroutine.calls < CHIP8_MEMO_HOT_THRESHOLD) return 0;
+
+	return record(subroutine, maxInstructions);
+}
+
+//Runs the call on the interpreter and keeps its reads and writes, if it returns within maxInstructions
+unsigned long Chip8Memo::record(Subroutine& subroutine, unsigned long maxInstructions) {
+	const uint16_t sp = chip8.state.sp;
+
+	readCells.reset();
+	writtenCells.reset();
+	recordedCode.reset();
+	recording.reads.clear();
+	recording.writes.clear();
+	writeLocations.clear();
+
+	bool valid = sp > 0;
+	unsigned long executed = 0;
+
+	while (valid && executed < std::min(maxInstructions, CHIP8_MEMO_MAX_INSTRUCTIONS)) {
+		if (chip8.state.pc + 1u >= CHIP8_MEMORY_SIZE) {
+			valid = false;
+			break;
+		}
+
+		//Code written by the call itself would have to be part of the key
+		unsigned int pc = chip8.state.pc;
+
+		if (writtenCells[CELL_MEMORY + pc] || writtenCells[CELL_MEMORY + pc + 1]) {
+			valid = false;
+			break;
+		}
+
+		recordedCode[pc] = true;
+		recordedCode[pc + 1] = true;
+
+		valid = track(chip8.decodedAt(pc));
+
+		if (!valid) break;
+
+		chip8.execute();
+		executed++;
+		chip8.countInstructions(1);
+
+		valid = chip8.state.running && recording.reads.size() <= CHIP8_MEMO_MAX_CELLS && writeLocations.size() <= CHIP8_MEMO_MAX_CELLS;
+
+		if (chip8.state.sp < sp) break;
+	}
+
+	if (valid && chip8.state.sp < sp) {
+		for (uint16_t location : writeLocations) {
+			if (location < CELL_SCREEN && recordedCode[location - CELL_MEMORY]) {
+				valid = false;
+				break;
+			}
+
+			recording.writes.push_back({ location, load(location) });
+		}
+
+		//Comparing the key should take less time than running the call
+		if (executed < CHIP8_MEMO_MIN_INSTRUCTIONS || recording.reads.size() + recording.writes.size() > executed) {
+			valid = false;
+		}
+
+		if (valid) {
+			recording.instructions = executed;
+			recording.sp = sp;
+
+			if (subroutine.results.empty()) {
+				recorded.push_back(static_cast<uint16_t>(&subroutine - subroutines.data()));
+			}
+
+			if (subroutine.results.size() < CHIP8_MEMO_MAX_RESULTS) {
+				subroutine.results.push_back(recording);
+			} else {
+				subroutine.results[subroutine.nextReplaced] = recording;
+				subroutine.nextReplaced = (subroutine.nextReplaced + 1) % CHIP8_MEMO_MAX_RESULTS;
+			}
+
+			code |= recordedCode;
+			return executed;
+		}
+	}
+
+	//Ran out of budget before the return, that call may still be recorded next time
+	if (valid && executed < CHIP8_MEMO_MAX_INSTRUCTIONS) {
+		return executed;
+	}
+
+	reject(static_cast<unsigned int>(&subroutine - subroutines.data()));
+
+	return executed;
+}
+
+//Marks the cells an instruction reads and writes, false if its effect does not only depend on cells
+bool Chip8Memo::track(const Chip8::DecodedInstruction& ins) {
+	const Chip8State& state = chip8.state;
+	const unsigned int vx = CELL_REGISTERS + ins.x;
+	const unsigned int vy = CELL_REGISTERS + ins.y;
+	const unsigned int vf = CELL_REGISTERS + CARRY_REGISTER;
+
+	if (ins.handler == &Chip8::opClearScreen) {
+		for (int y = 0; y < CHIP8_SCREEN_HEIGHT; y++) {
+			write(CELL_SCREEN + y);
+		}
+	} else if (ins.handler == &Chip8::opReturn) {
+		if (state.sp == 0) return false;
+
+		read(CELL_STACK + state.sp - 1);
+	} else if (ins.handler == &Chip8::opSubroutineCall) {
+		if (state.sp >= CHIP8_STACK_SIZE) return false;
+
+		write(CELL_STACK + state.sp);
+	} else if (ins.handler == &Chip8::opJump) {
+		//Only changes pc
+	} else if (ins.handler == &Chip8::opSkipIfEqual || ins.handler == &Chip8::opSkipIfNotEqual) {
+		read(vx);
+	} else if (ins.handler == &Chip8::opSkipIfRegistersEqual || ins.handler == &Chip8::opSkipIfRegistersNotEqual) {
+		read(vx);
+		read(vy);
+	} else if (ins.handler == &Chip8::opSetRegister) {
+		write(vx);
+	} else if (ins.handler == &Chip8::opRegisterAdd) {
+		read(vx);
+		write(vx);
+	} else if (ins.handler == &Chip8::opAssignRegisters) {
+		read(vy);
+		write(vx);
+	} else if (ins.handler == &Chip8::opBitwiseOr || ins.handler == &Chip8::opBitwiseAnd || ins.handler == &Chip8::opBitwiseXor) {
+		read(vx);
+		read(vy);
+		write(vx);
+	} else if (ins.handler == &Chip8::opAddRegisterAndSetCarry || ins.handler == &Chip8::opSubtractRegisterAndSetCarry || ins.handler == &Chip8::opSubtractRegisterAndSetCarryYX) {
+		read(vx);
+		read(vy);
+		write(vx);
+		write(vf);
+	} else if (ins.handler == &Chip8::opDivideLSB || ins.handler == &Chip8::opMultiplyMSB) {
+		read(vx);
+		write(vx);
+		write(vf);
+	} else if (ins.handler == &Chip8::opSetIndexRegister) {
+		write(CELL_INDEX);
+	} else if (ins.handler == &Chip8::opSetProgramCounterPlusV0) {
+		read(CELL_REGISTERS);
+	} else if (ins.handler == &Chip8::opDrawSprite) {
+		read(vx);
+		read(vy);
+		read(CELL_INDEX);
+
+		for (int i = 0; i < ins.n; i++) {
+			unsigned int row = CELL_SCREEN + (state.registers[ins.y] + i) % CHIP8_SCREEN_HEIGHT;
+
+			read(CELL_MEMORY + ((state.indexRegister + i) & 0x0FFF));
+			read(row);
+			write(row);
+		}
+
+		write(vf);
+	} else if (ins.handler == &Chip8::opSkipIfKeyIsPressed || ins.handler == &Chip8::opSkipIfKeyIsNotPressed) {
+		read(vx);
+		read(CELL_KEYS);
+	} else if (ins.handler == &Chip8::opIndexAdd) {
+		read(CELL_INDEX);
+		read(vx);
+		write(CELL_INDEX);
+	} else if (ins.handler == &Chip8::opIndexSetFont) {
+		read(vx);
+		write(CELL_INDEX);
+	} else if (ins.handler == &Chip8::opIndexBCD) {
+		read(vx);
+		read(CELL_INDEX);
+
+		for (int i = 0; i < 3; i++) {
+			write(CELL_MEMORY + ((state.indexRegister + i) & 0x0FFF));
+		}
+	} else if (ins.handler == &Chip8::opRegistersToMemory) {
+		read(CELL_INDEX);
+
+		for (int i = 0; i <= ins.x; i++) {
+			read(CELL_REGISTERS + i);
+			write(CELL_MEMORY + ((state.indexRegister + i) & 0x0FFF));
+		}
+	} else if (ins.handler == &Chip8::opMemoryToRegisters) {
+		read(CELL_INDEX);
+
+		for (int i = 0; i <= ins.x; i++) {
+			read(CELL_MEMORY + ((state.indexRegister + i) & 0x0FFF));
+			write(CELL_REGISTERS + i);
+		}
+	} else {
+		//Cxkk, the timers, Fx0A and unknown opcodes
+		return false;
+	}
+
+	return true;
+}
+
+//A cell is part of the key if it is read before the call wrote it
+void Chip8Memo::read(unsigned int location) {
+	if (readCells[location] || writtenCells[location]) return;
+
+	readCells[location] = true;
+	recording.reads.push_back({ static_cast<uint16_t>(location), load(location) });
+}
+
+void Chip8Memo::write(unsigned int location) {
+	if (writtenCells[location]) return;
+
+	writtenCells[location] = true;
+	writeLocations.push_back(static_cast<uint16_t>(location));
+}
+
+uint64_t Chip8Memo::load(unsigned int location) const {
+	const Chip8State& state = chip8.state;
+
+	if (location < CELL_SCREEN) return state.memory[location - CELL_MEMORY];
+	if (location < CELL_STACK) return state.screen[location - CELL_SCREEN];
+	if (location < CELL_REGISTERS) return state.stack[location - CELL_STACK];
+	if (location < CELL_INDEX) return state.registers[location - CELL_REGISTERS];
+	if (location == CELL_INDEX) return state.indexRegister;
+
+	return state.inputMask;
+}
+
+void Chip8Memo::store(unsigned int location, uint64_t value) {
+	Chip8State& state = chip8.state;
+
+	if (location < CELL_SCREEN) {
+		chip8.writeMemory(location - CELL_MEMORY, static_cast<uint8_t>(value));
+	} else if (location < CELL_STACK) {
+		state.screen[location - CELL_SCREEN] = value;
+		chip8.dirtyRows |= 1u << (location - CELL_SCREEN);
+	} else if (location < CELL_REGISTERS) {
+		state.stack[location - CELL_STACK] = static_cast<uint16_t>(value);
+	} else if (location < CELL_INDEX) {
+		state.registers[location - CELL_REGISTERS] = static_cast<uint8_t>(value);
+	} else if (location == CELL_INDEX) {
+		state.indexRegister = static_cast<uint16_t>(value);
+	}
+}
+
+//Results may be in use when code is written, so they are only dropped before the next lookup
+void Chip8Memo::invalidate(unsigned int address) {
+	if (code[address % CHIP8_MEMORY_SIZE]) {
+		stale = true;
+	}
+}
+
+void Chip8Memo::flush() {
+	stale = true;
+}
+
+void Chip8Memo::reject(unsigned int address) {
+	rejected[address] = true;
+	subroutines[address].results.clear();
+}
+
+//Writes into blocks also flush, which happens often in some ROMs, so only the recorded subroutines are visited
+void Chip8Memo::clear() {
+	for (uint16_t address : recorded) {
+		subroutines[address].results.clear();
+		subroutines[address].nextReplaced = 0;
+	}
+
+	recorded.clear();
+	code.reset();
+	stale = false;
+}
+
+unsigned long Chip8Memo::getHits() const {
+	return hits;
+}
+
+unsigned long Chip8Memo::getSkippedInstructions() const {
+	return skippedInstructions;
+}
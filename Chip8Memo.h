@@ -0,0 +1,146 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef CHIP8MEMO_H
+#define CHIP8MEMO_H
+
+#include "Chip8.h"
+#include <bitset>
+
+const unsigned int CHIP8_MEMO_HOT_THRESHOLD = 4; //calls of a subroutine before its results get recorded
+const std::size_t CHIP8_MEMO_MAX_RESULTS = 32; //recorded results kept per subroutine
+const std::size_t CHIP8_MEMO_MAX_CELLS = 256; //bytes, rows or registers a subroutine may read, and as many it may write
+const unsigned long CHIP8_MEMO_MIN_INSTRUCTIONS = 8; //shorter calls run faster than their result is looked up
+const unsigned long CHIP8_MEMO_MAX_INSTRUCTIONS = 65536; //longer calls are not recorded
+const unsigned long CHIP8_MEMO_TRIAL_CALLS = 64; //calls after which a subroutine must hit at least a quarter of the time
+const unsigned long CHIP8_MEMO_WINDOW = 16384; //instructions of which at least half must be skipped, else the block engine runs alone
+const unsigned long CHIP8_MEMO_MAX_BLOCKS = 256 * CHIP8_MEMO_WINDOW; //longest run of the block engine before lookups are tried again
+
+//Memory bytes, screen rows, stack slots, registers, I and the pressed keys
+const unsigned int CHIP8_MEMO_CELLS = CHIP8_MEMORY_SIZE + CHIP8_SCREEN_HEIGHT + CHIP8_STACK_SIZE + CHIP8_REGISTERS + 2;
+
+/*
+	Subroutine memoization.
+
+	Many subroutines (2nnn ... 00EE) are pure functions of a few registers,
+	memory bytes and screen rows: a digit drawn at the same place, a cell of a
+	Life generation. When a hot subroutine is entered, it is first run on the
+	interpreter while every read and write is tracked. Each value read before
+	the subroutine wrote it, including the return address on the stack, becomes
+	part of the key, and the final value of every written one the result.
+	The next time the subroutine is entered with the same values in all of its
+	read cells, the result is written back and the instructions are counted
+	without running them.
+
+	Only subroutines that neither use random numbers, the timers nor Fx0A and
+	do not modify their own code are recorded. Timer ticks during a call
+	change nothing it can see, so a call may span them, but not the end of
+	the instruction budget (a frame). Code bytes are not part of the key:
+	writing any of them drops every result, like for the JIT. Subroutines
+	that rarely hit are given up on for good, and everything else runs on
+	the block engine.
+
+	Looking up results and leaving the chained blocks at every call costs
+	time even when nothing hits, up to half the speed of the block engine.
+	So hits are measured over windows of CHIP8_MEMO_WINDOW instructions:
+	when less than half of a window was skipped, Chip8::executeBlocks()
+	runs alone for one window, then for twice as long after every window
+	that does not pay off, up to CHIP8_MEMO_MAX_BLOCKS. One window that
+	does pay off resets it.
+*/
+class Chip8Memo : public Chip8CodeListener {
+public:
+	explicit Chip8Memo(Chip8& target);
+	~Chip8Memo();
+
+	unsigned long execute(unsigned long maxInstructions);
+
+	void invalidate(unsigned int address) override;
+	void flush() override;
+
+	unsigned long getHits() const; //calls replaced by a recorded result
+	unsigned long getSkippedInstructions() const; //instructions those calls would have run
+private:
+	//A memory byte, screen row, stack slot, register, I or the pressed keys, numbered in that order
+	struct Cell {
+		uint16_t location;
+		uint64_t value;
+	};
+
+	struct Result {
+		std::vector<Cell> reads; //values at the entry
+		std::vector<Cell> writes; //values at the return
+		unsigned long instructions;
+		uint16_t sp; //at the entry, stack cells are absolute slots so it is part of the key
+	};
+
+	struct Subroutine {
+		std::vector<Result> results;
+		std::size_t nextReplaced; //oldest result, replaced once there are CHIP8_MEMO_MAX_RESULTS
+		unsigned long calls;
+		unsigned long hits;
+	};
+
+	unsigned long enter(unsigned long maxInstructions);
+	unsigned long record(Subroutine& subroutine, unsigned long maxInstructions);
+	bool track(const Chip8::DecodedInstruction& ins);
+	void read(unsigned int location);
+	void write(unsigned int location);
+
+	uint64_t load(unsigned int location) const;
+	void store(unsigned int location, uint64_t value);
+
+	void reject(unsigned int address);
+	void clear();
+
+	Chip8& chip8;
+
+	std::vector<Subroutine> subroutines; //by entry address
+	std::vector<uint16_t> recorded; //entry addresses of the subroutines with results
+	std::bitset<CHIP8_MEMORY_SIZE> rejected; //cannot be recorded or rarely hit, never looked up again and kept when the results are dropped
+	std::bitset<CHIP8_MEMORY_SIZE> code; //bytes run by any recorded call
+	bool stale; //code was written, results are dropped before the next lookup
+
+	//Call being recorded
+	std::bitset<CHIP8_MEMO_CELLS> readCells;
+	std::bitset<CHIP8_MEMO_CELLS> writtenCells;
+	std::bitset<CHIP8_MEMORY_SIZE> recordedCode;
+	Result recording;
+	std::vector<uint16_t> writeLocations;
+
+	//Hit rate of the current window
+	unsigned long windowInstructions;
+	unsigned long windowSkipped; //skippedInstructions at its start
+	unsigned long blockInstructions; //left to run on the block engine alone
+	unsigned long blockRun; //length of the next such run
+
+	unsigned long hits;
+	unsigned long skippedInstructions;
+};
+
+#endif
@@ -0,0 +1,147 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "Chip8Movie.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+Chip8Movie::Chip8Movie() {
+	frames = 0;
+	seed = CHIP8_DEFAULT_SEED;
+	romHash = 0;
+	cycles = CHIP8_DEFAULT_CYCLES;
+}
+
+void Chip8Movie::start(const Chip8& chip8, uint64_t seed) {
+	runs.clear();
+	frames = 0;
+
+	this->seed = seed;
+	romHash = chip8.getRomHash();
+	cycles = chip8.getCycles();
+}
+
+void Chip8Movie::record(uint16_t keys) {
+	if (runs.empty() || runs.back().keys != keys) {
+		runs.push_back({ frames, keys });
+	}
+
+	frames++;
+}
+
+void Chip8Movie::truncate(unsigned long frames) {
+	if (frames >= this->frames) {
+		return;
+	}
+
+	while (!runs.empty() && runs.back().start >= frames) {
+		runs.pop_back();
+	}
+
+	this->frames = frames;
+}
+
+uint16_t Chip8Movie::getKeys(unsigned long frame) const {
+	if (frame >= frames) {
+		return 0;
+	}
+
+	auto run = std::upper_bound(runs.begin(), runs.end(), frame, [](unsigned long target, const Run& run) {
+		return target < run.start;
+	});
+
+	return (run - 1)->keys;
+}
+
+unsigned long Chip8Movie::getFrameCount() const {
+	return frames;
+}
+
+uint64_t Chip8Movie::getSeed() const {
+	return seed;
+}
+
+uint64_t Chip8Movie::getRomHash() const {
+	return romHash;
+}
+
+int Chip8Movie::getCycles() const {
+	return cycles;
+}
+
+bool Chip8Movie::save(const std::string& filename) const {
+	std::ofstream file(filename, std::ios::binary);
+
+	if (!file) {
+		return false;
+	}
+
+	Chip8MovieHeader header = { { 'C', '8', 'M', 'V' }, CHIP8_MOVIE_VERSION, seed, romHash, static_cast<uint32_t>(cycles), 0 };
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	for (std::size_t i = 0; i < runs.size(); i++) {
+		unsigned long end = i + 1 < runs.size() ? runs[i + 1].start : frames;
+		uint32_t length = static_cast<uint32_t>(end - runs[i].start);
+
+		file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+		file.write(reinterpret_cast<const char*>(&runs[i].keys), sizeof(runs[i].keys));
+	}
+
+	return static_cast<bool>(file);
+}
+
+bool Chip8Movie::load(const std::string& filename) {
+	std::ifstream file(filename, std::ios::binary);
+	Chip8MovieHeader header;
+
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| std::memcmp(header.magic, "C8MV", 4) != 0 || header.version != CHIP8_MOVIE_VERSION) {
+		return false;
+	}
+
+	seed = header.seed;
+	romHash = header.romHash;
+	cycles = static_cast<int>(header.cycles);
+
+	runs.clear();
+	frames = 0;
+
+	uint32_t length;
+	uint16_t keys;
+
+	while (file.read(reinterpret_cast<char*>(&length), sizeof(length)) && file.read(reinterpret_cast<char*>(&keys), sizeof(keys))) {
+		if (length == 0) continue;
+
+		runs.push_back({ frames, keys });
+		frames += length;
+	}
+
+	return true;
+}
@@ -0,0 +1,84 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef CHIP8MOVIE_H
+#define CHIP8MOVIE_H
+
+#include "Chip8.h"
+
+const uint32_t CHIP8_MOVIE_VERSION = 1;
+
+/*
+	Movie file: this header, then one [uint32 frames][uint16 keys] run per
+	change of the pressed keys until the end of the file.
+
+	A movie starts at power on: the ROM is loaded, the machine prepared and
+	seeded with seed, and each frame runs with the recorded keys held. As
+	the core is deterministic, that replays the run bit-exact.
+*/
+struct Chip8MovieHeader {
+	char magic[4]; //"C8MV"
+	uint32_t version;
+	uint64_t seed;
+	uint64_t romHash; //Chip8::getRomHash() of the ROM it was recorded on
+	uint32_t cycles; //speed, it decides how many instructions a frame runs
+	uint32_t reserved;
+};
+
+class Chip8Movie {
+public:
+	Chip8Movie();
+
+	void start(const Chip8& chip8, uint64_t seed); //new recording for a prepared, just seeded machine
+	void record(uint16_t keys); //keys held during the next frame
+	void truncate(unsigned long frames); //drop the frames from here on, e.g. after a rewind
+
+	uint16_t getKeys(unsigned long frame) const; //keys held during the frame, none after the end
+	unsigned long getFrameCount() const;
+
+	uint64_t getSeed() const;
+	uint64_t getRomHash() const;
+	int getCycles() const;
+
+	bool save(const std::string& filename) const;
+	bool load(const std::string& filename);
+private:
+	struct Run {
+		unsigned long start; //first frame
+		uint16_t keys;
+	};
+
+	std::vector<Run> runs;
+	unsigned long frames;
+
+	uint64_t seed;
+	uint64_t romHash;
+	int cycles;
+};
+
+#endif
@@ -0,0 +1,240 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "Chip8Rewind.h"
+#include <algorithm>
+#include <cstring>
+
+static uint64_t loadWord(const uint8_t* p, std::size_t word) {
+	uint64_t value;
+	std::memcpy(&value, p + word * sizeof(uint64_t), sizeof(uint64_t));
+	return value;
+}
+
+static void storeWord(uint8_t* p, std::size_t word, uint64_t value) {
+	std::memcpy(p + word * sizeof(uint64_t), &value, sizeof(uint64_t));
+}
+
+Chip8Rewind::Chip8Rewind(std::size_t bytes, unsigned int frames, unsigned int keyframeInterval) :
+	data(std::max(bytes, 4 * CHIP8_MAX_DELTA_SIZE)),
+	entries(std::max(frames, 2u)),
+	scratch(CHIP8_MAX_DELTA_SIZE) {
+	this->keyframeInterval = std::max(keyframeInterval, 1u);
+
+	clear();
+}
+
+void Chip8Rewind::clear() {
+	oldest = 0;
+	next = 0;
+	keyframeIndex = 0;
+	writeOffset = 0;
+	usedBytes = 0;
+	sinceKeyframe = 0;
+}
+
+unsigned int Chip8Rewind::getFrameCount() const {
+	return static_cast<unsigned int>(next - oldest);
+}
+
+std::size_t Chip8Rewind::getUsedBytes() const {
+	return usedBytes;
+}
+
+const Chip8Rewind::Entry& Chip8Rewind::entryAt(unsigned long index) const {
+	return entries[index % entries.size()];
+}
+
+bool Chip8Rewind::hasKeyframe() const {
+	return oldest != next && keyframeIndex >= oldest && keyframeIndex < next;
+}
+
+void Chip8Rewind::push(const Chip8State& state) {
+	bool delta = hasKeyframe() && sinceKeyframe + 1 < keyframeInterval;
+	std::size_t size = sizeof(Chip8State);
+
+	if (delta) {
+		const Chip8State& keyframe = *reinterpret_cast<const Chip8State*>(&data[entryAt(keyframeIndex).offset]);
+
+		size = encodeDelta(keyframe, state, scratch.data());
+
+		//Not worth it if it is no smaller than the state
+		delta = size < sizeof(Chip8State);
+	}
+
+	std::size_t offset = 0;
+
+	if (delta) {
+		offset = allocate(size);
+
+		//Making room may have dropped the keyframe itself
+		delta = hasKeyframe();
+	}
+
+	Entry& entry = entries[next % entries.size()];
+
+	if (delta) {
+		std::memcpy(&data[offset], scratch.data(), size);
+
+		entry.keyframe = keyframeIndex;
+		sinceKeyframe++;
+	} else {
+		size = sizeof(Chip8State);
+		offset = allocate(size);
+
+		std::memcpy(&data[offset], &state, size);
+
+		entry.keyframe = next;
+		keyframeIndex = next;
+		sinceKeyframe = 0;
+	}
+
+	entry.offset = offset;
+	entry.size = size;
+
+	writeOffset = offset + (size + 7) / 8 * 8;
+	usedBytes += size;
+	next++;
+}
+
+bool Chip8Rewind::pop(Chip8State& out) {
+	if (oldest == next) {
+		return false;
+	}
+
+	const Entry& entry = entryAt(next - 1);
+
+	std::memcpy(&out, &data[entryAt(entry.keyframe).offset], sizeof(Chip8State));
+
+	if (entry.keyframe != next - 1) {
+		applyDelta(&data[entry.offset], entry.size, out);
+	}
+
+	//The freed space is reused by the next push
+	writeOffset = entry.offset;
+	usedBytes -= entry.size;
+	next--;
+
+	if (oldest != next) {
+		keyframeIndex = entryAt(next - 1).keyframe;
+		sinceKeyframe = static_cast<unsigned int>(next - 1 - keyframeIndex);
+	}
+
+	return true;
+}
+
+std::size_t Chip8Rewind::allocate(std::size_t size) {
+	std::size_t offset = writeOffset;
+
+	if (offset + size > data.size()) {
+		offset = 0;
+	}
+
+	while (oldest != next && next - oldest >= entries.size()) {
+		dropOldest();
+	}
+
+	while (oldest != next) {
+		const Entry& entry = entryAt(oldest);
+
+		if (entry.offset >= offset + size || entry.offset + entry.size <= offset) break;
+
+		dropOldest();
+	}
+
+	return offset;
+}
+
+//Deltas cannot be decoded without their keyframe, so they go together with it
+void Chip8Rewind::dropOldest() {
+	do {
+		usedBytes -= entryAt(oldest).size;
+		oldest++;
+	} while (oldest != next && entryAt(oldest).keyframe != oldest);
+}
+
+std::size_t Chip8Rewind::encodeDelta(const Chip8State& keyframe, const Chip8State& state, uint8_t* out) {
+	const uint8_t* a = reinterpret_cast<const uint8_t*>(&keyframe);
+	const uint8_t* b = reinterpret_cast<const uint8_t*>(&state);
+
+	std::size_t size = 0;
+	std::size_t word = 0;
+
+	while (word < CHIP8_STATE_WORDS) {
+		std::size_t start = word;
+
+		while (word < CHIP8_STATE_WORDS && loadWord(a, word) == loadWord(b, word)) {
+			word++;
+		}
+
+		if (word == CHIP8_STATE_WORDS) break;
+
+		uint16_t zeros = static_cast<uint16_t>(word - start);
+		uint16_t literals = 0;
+		std::size_t header = size;
+
+		size += 2 * sizeof(uint16_t);
+
+		uint64_t diff;
+
+		while (word < CHIP8_STATE_WORDS && (diff = loadWord(a, word) ^ loadWord(b, word)) != 0) {
+			storeWord(out + size, 0, diff);
+			size += sizeof(uint64_t);
+			literals++;
+			word++;
+		}
+
+		std::memcpy(out + header, &zeros, sizeof(uint16_t));
+		std::memcpy(out + header + sizeof(uint16_t), &literals, sizeof(uint16_t));
+	}
+
+	return size;
+}
+
+void Chip8Rewind::applyDelta(const uint8_t* delta, std::size_t size, Chip8State& keyframeToState) {
+	uint8_t* out = reinterpret_cast<uint8_t*>(&keyframeToState);
+
+	std::size_t position = 0;
+	std::size_t word = 0;
+
+	while (position + 2 * sizeof(uint16_t) <= size) {
+		uint16_t zeros;
+		uint16_t literals;
+
+		std::memcpy(&zeros, delta + position, sizeof(uint16_t));
+		std::memcpy(&literals, delta + position + sizeof(uint16_t), sizeof(uint16_t));
+		position += 2 * sizeof(uint16_t);
+
+		word += zeros;
+
+		for (uint16_t i = 0; i < literals && word < CHIP8_STATE_WORDS; i++, word++) {
+			storeWord(out, word, loadWord(out, word) ^ loadWord(delta + position, 0));
+			position += sizeof(uint64_t);
+		}
+	}
+}
@@ -0,0 +1,99 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef CHIP8REWIND_H
+#define CHIP8REWIND_H
+
+#include "Chip8.h"
+
+const std::size_t CHIP8_REWIND_BYTES = 4 * 1024 * 1024; //default memory for snapshots, several minutes of a typical game
+const unsigned int CHIP8_REWIND_FRAMES = 60 * 60 * 10; //default limit of snapshots, 10 minutes
+const unsigned int CHIP8_KEYFRAME_INTERVAL = 120; //frames between full snapshots
+
+const std::size_t CHIP8_STATE_WORDS = sizeof(Chip8State) / sizeof(uint64_t);
+const std::size_t CHIP8_MAX_DELTA_SIZE = sizeof(Chip8State) * 2; //worst case of Chip8Rewind::encodeDelta()
+
+static_assert(sizeof(Chip8State) % sizeof(uint64_t) == 0, "Chip8State is compared as whole words");
+
+/*
+	Memory-bounded history of machine states for rewinding.
+
+	Every CHIP8_KEYFRAME_INTERVAL frames a full Chip8State is stored, and the
+	frames in between as the XOR of their state with that keyframe, run-length
+	encoded. A frame usually touches a few screen rows, registers and timers,
+	so the XOR is mostly zero words and a snapshot takes a few hundred bytes.
+
+	Snapshots go into a single preallocated ring of bytes. When it is full,
+	the oldest keyframe and the deltas depending on it are dropped, so
+	push() never allocates.
+*/
+class Chip8Rewind {
+public:
+	explicit Chip8Rewind(std::size_t bytes = CHIP8_REWIND_BYTES, unsigned int frames = CHIP8_REWIND_FRAMES, unsigned int keyframeInterval = CHIP8_KEYFRAME_INTERVAL);
+
+	void push(const Chip8State& state); //call before running a frame, pop() then steps back one frame
+	bool pop(Chip8State& out); //removes the newest snapshot and returns it, false if there is none
+	void clear();
+
+	unsigned int getFrameCount() const; //snapshots that can be rewound
+	std::size_t getUsedBytes() const;
+
+	/*
+		Delta encoding of a state against a keyframe, as a list of
+		[uint16 zero words][uint16 literal words][literal words...] runs over
+		the XOR of both states. out must hold CHIP8_MAX_DELTA_SIZE bytes.
+	*/
+	static std::size_t encodeDelta(const Chip8State& keyframe, const Chip8State& state, uint8_t* out);
+	static void applyDelta(const uint8_t* delta, std::size_t size, Chip8State& keyframeToState); //turns a copy of the keyframe into the state
+private:
+	struct Entry {
+		std::size_t offset; //in data, a multiple of 8
+		std::size_t size;
+		unsigned long keyframe; //index of the keyframe it is a delta against, its own index if it is one
+	};
+
+	const Entry& entryAt(unsigned long index) const;
+	std::size_t allocate(std::size_t size); //drops the oldest snapshots until size bytes are free at the write position, returns it
+	void dropOldest();
+	bool hasKeyframe() const; //the keyframe of the newest snapshots is still stored
+
+	std::vector<uint8_t> data;
+	std::vector<Entry> entries; //ring, entry i is at entries[i % entries.size()]
+	std::vector<uint8_t> scratch; //delta being encoded
+
+	unsigned long oldest; //index of the oldest snapshot
+	unsigned long next; //index the next snapshot gets
+	unsigned long keyframeIndex; //index of the keyframe new deltas refer to
+	std::size_t writeOffset;
+	std::size_t usedBytes;
+
+	unsigned int keyframeInterval;
+	unsigned int sinceKeyframe; //deltas stored since keyframeIndex
+};
+
+#endif
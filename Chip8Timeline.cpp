@@ -0,0 +1,227 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "Chip8Timeline.h"
+#include "Chip8Rewind.h"
+#include <algorithm>
+#include <cstring>
+
+Chip8TimelineWriter::Chip8TimelineWriter() : scratch(CHIP8_MAX_DELTA_SIZE) {
+	keyframeInterval = CHIP8_TIMELINE_KEYFRAME_INTERVAL;
+	frames = 0;
+	offset = 0;
+}
+
+bool Chip8TimelineWriter::open(const std::string& filename, unsigned int keyframeInterval) {
+	close();
+
+	timeline.open(filename, std::ios::binary | std::ios::trunc);
+	index.open(filename + ".idx", std::ios::binary | std::ios::trunc);
+
+	if (!timeline || !index) {
+		close();
+		return false;
+	}
+
+	this->keyframeInterval = std::max(keyframeInterval, 1u);
+	frames = 0;
+
+	Chip8TimelineHeader header = { { 'C', '8', 'T', 'L' }, CHIP8_TIMELINE_VERSION, sizeof(Chip8State), this->keyframeInterval };
+
+	timeline.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	offset = sizeof(header);
+
+	return static_cast<bool>(timeline);
+}
+
+bool Chip8TimelineWriter::append(const Chip8State& state) {
+	if (!isOpen()) {
+		return false;
+	}
+
+	Chip8TimelineRecord record = { CHIP8_TIMELINE_DELTA, 0, state.inputMask, 0 };
+	const uint8_t* payload = scratch.data();
+
+	if (frames % keyframeInterval == 0) {
+		std::memcpy(&keyframe, &state, sizeof(Chip8State));
+
+		record.kind = CHIP8_TIMELINE_KEYFRAME;
+		record.size = sizeof(Chip8State);
+		payload = reinterpret_cast<const uint8_t*>(&keyframe);
+	} else {
+		record.size = static_cast<uint32_t>(Chip8Rewind::encodeDelta(keyframe, state, scratch.data()));
+	}
+
+	timeline.write(reinterpret_cast<const char*>(&record), sizeof(record));
+	timeline.write(reinterpret_cast<const char*>(payload), record.size);
+
+	//The index must never point past what reached the timeline
+	if (record.kind == CHIP8_TIMELINE_KEYFRAME) {
+		Chip8TimelineIndexEntry entry = { frames, offset };
+
+		timeline.flush();
+		index.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		index.flush();
+	}
+
+	offset += sizeof(record) + record.size;
+	frames++;
+
+	return timeline && index;
+}
+
+void Chip8TimelineWriter::close() {
+	if (timeline.is_open()) timeline.close();
+	if (index.is_open()) index.close();
+}
+
+bool Chip8TimelineWriter::isOpen() const {
+	return timeline.is_open() && index.is_open() && timeline && index;
+}
+
+unsigned long Chip8TimelineWriter::getFrameCount() const {
+	return frames;
+}
+
+Chip8TimelineReader::Chip8TimelineReader() : payload(CHIP8_MAX_DELTA_SIZE) {
+	frames = 0;
+}
+
+bool Chip8TimelineReader::open(const std::string& filename) {
+	keyframes.clear();
+	frames = 0;
+
+	if (timeline.is_open()) timeline.close();
+	timeline.clear();
+	timeline.open(filename, std::ios::binary);
+
+	Chip8TimelineHeader header;
+
+	if (!timeline.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| std::memcmp(header.magic, "C8TL", 4) != 0
+		|| header.version != CHIP8_TIMELINE_VERSION || header.stateSize != sizeof(Chip8State)) {
+		return false;
+	}
+
+	timeline.seekg(0, std::ios::end);
+	const uint64_t fileSize = static_cast<uint64_t>(timeline.tellg());
+
+	std::ifstream index(filename + ".idx", std::ios::binary);
+	Chip8TimelineIndexEntry entry;
+
+	while (index.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+		if (entry.offset >= fileSize || (!keyframes.empty() && entry.frame <= keyframes.back().frame)) break;
+
+		keyframes.push_back(entry);
+	}
+
+	//Scan from the last indexed keyframe on: it counts the frames and finds keyframes the index missed
+	uint64_t position = sizeof(header);
+	unsigned long frame = 0;
+
+	if (!keyframes.empty()) {
+		position = keyframes.back().offset;
+		frame = static_cast<unsigned long>(keyframes.back().frame);
+		keyframes.pop_back();
+	}
+
+	Chip8TimelineRecord record;
+
+	timeline.clear();
+	timeline.seekg(position);
+
+	while (readRecord(record) && position + sizeof(record) + record.size <= fileSize) {
+		if (record.kind == CHIP8_TIMELINE_KEYFRAME) {
+			keyframes.push_back({ frame, position });
+		}
+
+		position += sizeof(record) + record.size;
+		frame++;
+
+		timeline.seekg(position);
+	}
+
+	frames = frame;
+	timeline.clear();
+
+	return true;
+}
+
+unsigned long Chip8TimelineReader::getFrameCount() const {
+	return frames;
+}
+
+bool Chip8TimelineReader::readRecord(Chip8TimelineRecord& record) {
+	return static_cast<bool>(timeline.read(reinterpret_cast<char*>(&record), sizeof(record)));
+}
+
+bool Chip8TimelineReader::seek(unsigned long frame, Chip8State& out) {
+	if (frame >= frames) {
+		return false;
+	}
+
+	auto keyframe = std::upper_bound(keyframes.begin(), keyframes.end(), frame, [](unsigned long target, const Chip8TimelineIndexEntry& entry) {
+		return target < entry.frame;
+	});
+
+	if (keyframe == keyframes.begin()) {
+		return false;
+	}
+
+	--keyframe;
+
+	Chip8TimelineRecord record;
+
+	timeline.clear();
+	timeline.seekg(keyframe->offset);
+
+	if (!readRecord(record) || record.kind != CHIP8_TIMELINE_KEYFRAME || record.size != sizeof(Chip8State)
+		|| !timeline.read(reinterpret_cast<char*>(&out), sizeof(Chip8State))) {
+		return false;
+	}
+
+	//Deltas are against the keyframe, so only the headers in between are read
+	for (unsigned long skipped = static_cast<unsigned long>(keyframe->frame) + 1; skipped < frame; skipped++) {
+		if (!readRecord(record)) return false;
+
+		timeline.seekg(record.size, std::ios::cur);
+	}
+
+	if (frame == keyframe->frame) {
+		return true;
+	}
+
+	if (!readRecord(record) || record.kind != CHIP8_TIMELINE_DELTA || record.size > payload.size()
+		|| !timeline.read(reinterpret_cast<char*>(payload.data()), record.size)) {
+		return false;
+	}
+
+	Chip8Rewind::applyDelta(payload.data(), record.size, out);
+
+	return true;
+}
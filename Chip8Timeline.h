@@ -0,0 +1,116 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef CHIP8TIMELINE_H
+#define CHIP8TIMELINE_H
+
+#include "Chip8.h"
+#include <fstream>
+
+const uint32_t CHIP8_TIMELINE_VERSION = 1;
+const unsigned int CHIP8_TIMELINE_KEYFRAME_INTERVAL = 600; //frames between full states, 10 seconds of emulated time
+
+/*
+	Session timeline, an append-only file with one record per frame:
+
+	header      "C8TL", version, sizeof(Chip8State), keyframe interval
+	records     [uint8 kind][uint8 0][uint16 input mask][uint32 size][payload]
+
+	A keyframe record holds the whole Chip8State, a delta record the XOR
+	against the last keyframe, encoded like Chip8Rewind::encodeDelta().
+	Each record is the state at the start of its frame.
+
+	Next to it, "<file>.idx" lists the frame and file offset of every
+	keyframe, so a frame is found with a binary search over the index and
+	one skip over at most a keyframe interval of record headers. Both files
+	are only ever appended to, so a run stopped at any point leaves them
+	readable up to the last whole record.
+*/
+struct Chip8TimelineHeader {
+	char magic[4]; //"C8TL"
+	uint32_t version;
+	uint32_t stateSize;
+	uint32_t keyframeInterval;
+};
+
+struct Chip8TimelineRecord {
+	uint8_t kind; //CHIP8_TIMELINE_KEYFRAME or CHIP8_TIMELINE_DELTA
+	uint8_t reserved;
+	uint16_t inputMask; //keys held during the frame
+	uint32_t size; //of the payload that follows
+};
+
+struct Chip8TimelineIndexEntry {
+	uint64_t frame;
+	uint64_t offset; //of the keyframe record in the timeline
+};
+
+const uint8_t CHIP8_TIMELINE_KEYFRAME = 0;
+const uint8_t CHIP8_TIMELINE_DELTA = 1;
+
+class Chip8TimelineWriter {
+public:
+	Chip8TimelineWriter();
+
+	bool open(const std::string& filename, unsigned int keyframeInterval = CHIP8_TIMELINE_KEYFRAME_INTERVAL);
+	bool append(const Chip8State& state); //next frame, false once a write failed
+	void close();
+
+	bool isOpen() const;
+	unsigned long getFrameCount() const;
+private:
+	std::ofstream timeline;
+	std::ofstream index;
+
+	Chip8State keyframe;
+	std::vector<uint8_t> scratch;
+
+	unsigned int keyframeInterval;
+	unsigned long frames;
+	uint64_t offset; //where the next record goes
+};
+
+class Chip8TimelineReader {
+public:
+	Chip8TimelineReader();
+
+	bool open(const std::string& filename); //rebuilds what the index misses from the timeline itself
+
+	unsigned long getFrameCount() const;
+	bool seek(unsigned long frame, Chip8State& out); //state at the start of the frame
+private:
+	bool readRecord(Chip8TimelineRecord& record); //header at the current position
+
+	std::ifstream timeline;
+	std::vector<Chip8TimelineIndexEntry> keyframes;
+	std::vector<uint8_t> payload;
+
+	unsigned long frames;
+};
+
+#endif
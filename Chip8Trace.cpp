@@ -0,0 +1,331 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#include "Chip8Trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+Chip8Tracer::Chip8Tracer(std::size_t bytes) :
+	blockCount(std::max<std::size_t>(bytes / CHIP8_TRACE_BLOCK_SIZE, 2)),
+	data(blockCount * CHIP8_TRACE_BLOCK_SIZE),
+	blockSizes(blockCount) {
+	for (auto& size : blockSizes) {
+		size.store(0, std::memory_order_relaxed);
+	}
+
+	block.store(0, std::memory_order_relaxed);
+	fill.store(0, std::memory_order_relaxed);
+
+	blockStart = data.data();
+	cursor = blockStart;
+	lastPc = 0x10000;
+}
+
+void Chip8Tracer::nextBlock() {
+	uint64_t current = block.load(std::memory_order_relaxed);
+
+	blockSizes[current % blockCount].store(static_cast<uint32_t>(cursor - blockStart), std::memory_order_release);
+	fill.store(0, std::memory_order_release);
+	block.store(current + 1, std::memory_order_release);
+
+	//Readers seeing the old block number must not see the writes into its reused slot
+	std::atomic_thread_fence(std::memory_order_release);
+
+	blockStart = &data[((current + 1) % blockCount) * CHIP8_TRACE_BLOCK_SIZE];
+	cursor = blockStart;
+	lastPc = 0x10000;
+}
+
+void Chip8Tracer::idle(uint16_t pc, unsigned long instructions) {
+	uint8_t* p = reserve();
+	uint32_t count = static_cast<uint32_t>(std::min<unsigned long>(instructions, 0xFFFFFFFFul));
+
+	*p++ = CHIP8_TRACE_IDLE;
+	*p++ = static_cast<uint8_t>(pc >> 8);
+	*p++ = static_cast<uint8_t>(pc);
+
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		*p++ = static_cast<uint8_t>(count >> shift);
+	}
+
+	cursor = p;
+	lastPc = 0x10000;
+
+	fill.store(static_cast<uint32_t>(cursor - blockStart), std::memory_order_release);
+}
+
+void Chip8Tracer::copy(std::vector<uint8_t>& out) const {
+	uint64_t last;
+	uint32_t lastFill;
+
+	//The fill must belong to the block it is read with
+	do {
+		last = block.load(std::memory_order_acquire);
+		lastFill = fill.load(std::memory_order_acquire);
+	} while (block.load(std::memory_order_acquire) != last);
+
+	uint64_t first = last + 1 > blockCount ? last + 1 - blockCount : 0;
+	std::vector<std::size_t> starts;
+
+	out.clear();
+
+	for (uint64_t seq = first; seq <= last; seq++) {
+		uint32_t size = seq == last ? lastFill : blockSizes[seq % blockCount].load(std::memory_order_acquire);
+		const uint8_t* start = &data[(seq % blockCount) * CHIP8_TRACE_BLOCK_SIZE];
+
+		starts.push_back(out.size());
+
+		for (int shift = 24; shift >= 0; shift -= 8) {
+			out.push_back(static_cast<uint8_t>(size >> shift));
+		}
+
+		out.insert(out.end(), start, start + std::min<std::size_t>(size, CHIP8_TRACE_BLOCK_SIZE));
+	}
+
+	//Drop the blocks whose slots the writer started reusing while they were copied
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	uint64_t now = block.load(std::memory_order_relaxed);
+
+	if (now + 1 > blockCount + first) {
+		uint64_t valid = now + 1 - blockCount;
+
+		out.erase(out.begin(), valid > last ? out.end() : out.begin() + starts[valid - first]);
+	}
+}
+
+bool Chip8Tracer::save(const std::string& filename) const {
+	std::vector<uint8_t> blocks;
+	copy(blocks);
+
+	std::ofstream file(filename, std::ios::binary);
+
+	if (!file) {
+		return false;
+	}
+
+	uint32_t version = CHIP8_TRACE_VERSION;
+
+	file.write("C8TR", 4);
+	file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+	file.write(reinterpret_cast<const char*>(blocks.data()), blocks.size());
+
+	return static_cast<bool>(file);
+}
+
+//Mnemonics as in Cowgod's Chip-8 Technical Reference
+std::string Chip8Tracer::disassemble(Opcode opcode) {
+	const unsigned int x = (opcode & 0x0F00) >> 8;
+	const unsigned int y = (opcode & 0x00F0) >> 4;
+	const unsigned int kk = opcode & 0x00FF;
+	const unsigned int nnn = opcode & 0x0FFF;
+
+	static const char* const ALU[16] = { "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "SHL", nullptr };
+
+	char text[32];
+
+	switch (opcode >> 12) {
+		case 0x0:
+			if (opcode == 0x00E0) return "CLS";
+			if (opcode == 0x00EE) return "RET";
+			std::snprintf(text, sizeof(text), "SYS %03X", nnn);
+			break;
+		case 0x1: std::snprintf(text, sizeof(text), "JP %03X", nnn); break;
+		case 0x2: std::snprintf(text, sizeof(text), "CALL %03X", nnn); break;
+		case 0x3: std::snprintf(text, sizeof(text), "SE V%X, %02X", x, kk); break;
+		case 0x4: std::snprintf(text, sizeof(text), "SNE V%X, %02X", x, kk); break;
+		case 0x5: std::snprintf(text, sizeof(text), "SE V%X, V%X", x, y); break;
+		case 0x6: std::snprintf(text, sizeof(text), "LD V%X, %02X", x, kk); break;
+		case 0x7: std::snprintf(text, sizeof(text), "ADD V%X, %02X", x, kk); break;
+		case 0x8:
+			if (!ALU[opcode & 0xF]) return "???";
+			std::snprintf(text, sizeof(text), "%s V%X, V%X", ALU[opcode & 0xF], x, y);
+			break;
+		case 0x9: std::snprintf(text, sizeof(text), "SNE V%X, V%X", x, y); break;
+		case 0xA: std::snprintf(text, sizeof(text), "LD I, %03X", nnn); break;
+		case 0xB: std::snprintf(text, sizeof(text), "JP V0, %03X", nnn); break;
+		case 0xC: std::snprintf(text, sizeof(text), "RND V%X, %02X", x, kk); break;
+		case 0xD: std::snprintf(text, sizeof(text), "DRW V%X, V%X, %X", x, y, opcode & 0xF); break;
+		case 0xE:
+			if (kk == 0x9E) std::snprintf(text, sizeof(text), "SKP V%X", x);
+			else if (kk == 0xA1) std::snprintf(text, sizeof(text), "SKNP V%X", x);
+			else return "???";
+			break;
+		case 0xF:
+			switch (kk) {
+				case 0x07: std::snprintf(text, sizeof(text), "LD V%X, DT", x); break;
+				case 0x0A: std::snprintf(text, sizeof(text), "LD V%X, K", x); break;
+				case 0x15: std::snprintf(text, sizeof(text), "LD DT, V%X", x); break;
+				case 0x18: std::snprintf(text, sizeof(text), "LD ST, V%X", x); break;
+				case 0x1E: std::snprintf(text, sizeof(text), "ADD I, V%X", x); break;
+				case 0x29: std::snprintf(text, sizeof(text), "LD F, V%X", x); break;
+				case 0x33: std::snprintf(text, sizeof(text), "LD B, V%X", x); break;
+				case 0x55: std::snprintf(text, sizeof(text), "LD [I], V%X", x); break;
+				case 0x65: std::snprintf(text, sizeof(text), "LD V%X, [I]", x); break;
+				default: return "???";
+			}
+			break;
+	}
+
+	return text;
+}
+
+bool Chip8Tracer::decode(const std::string& filename, std::ostream& out) {
+	std::ifstream file(filename, std::ios::binary);
+
+	if (!file) {
+		return false;
+	}
+
+	std::vector<uint8_t> trace((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	uint32_t version = 0;
+
+	if (trace.size() < 8 || std::memcmp(trace.data(), "C8TR", 4) != 0) {
+		return false;
+	}
+
+	std::memcpy(&version, &trace[4], sizeof(version));
+
+	if (version != CHIP8_TRACE_VERSION) {
+		return false;
+	}
+
+	std::size_t position = 8;
+
+	while (position + 4 <= trace.size()) {
+		std::size_t size = (std::size_t(trace[position]) << 24) | (trace[position + 1] << 16) | (trace[position + 2] << 8) | trace[position + 3];
+		position += 4;
+
+		size = std::min(size, trace.size() - position);
+
+		decodeBlock(&trace[position], size, out);
+		position += size;
+	}
+
+	return true;
+}
+
+void Chip8Tracer::decodeBlock(const uint8_t* block, std::size_t size, std::ostream& out) {
+	const uint8_t* p = block;
+	const uint8_t* end = block + size;
+	uint32_t lastPc = 0x10000;
+
+	char line[128];
+
+	while (p < end) {
+		uint8_t tag = *p++;
+
+		if (tag == CHIP8_TRACE_IDLE) {
+			if (end - p < 6) return;
+
+			unsigned int pc = (p[0] << 8) | p[1];
+			unsigned long count = (static_cast<unsigned long>(p[2]) << 24) | (p[3] << 16) | (p[4] << 8) | p[5];
+			p += 6;
+
+			std::snprintf(line, sizeof(line), "%03X        idle loop, %lu instructions skipped\n", pc, count);
+			out << line;
+
+			lastPc = 0x10000;
+			continue;
+		}
+
+		if (tag > CHIP8_TRACE_AT || end - p < (tag == CHIP8_TRACE_AT ? 4 : 2)) return;
+
+		unsigned int pc = lastPc + 2;
+
+		if (tag == CHIP8_TRACE_AT) {
+			pc = (p[0] << 8) | p[1];
+			p += 2;
+		}
+
+		Opcode opcode = static_cast<Opcode>((p[0] << 8) | p[1]);
+		p += 2;
+
+		const unsigned int x = (opcode & 0x0F00) >> 8;
+		const Chip8TraceEffect effect = getEffect(opcode);
+
+		std::ptrdiff_t payload = 0;
+
+		switch (effect) {
+			case TRACE_NONE: payload = 0; break;
+			case TRACE_VX: case TRACE_VF: case TRACE_DT: case TRACE_ST: payload = 1; break;
+			case TRACE_VX_VF: case TRACE_I: payload = 2; break;
+			case TRACE_BCD: payload = 5; break;
+			case TRACE_STORE: payload = 2 + x + 1; break;
+			case TRACE_LOAD: payload = x + 1; break;
+		}
+
+		if (end - p < payload) return;
+
+		int length = std::snprintf(line, sizeof(line), "%03X  %04X  %-16s", pc, opcode, disassemble(opcode).c_str());
+		char* text = line + length;
+		char* limit = line + sizeof(line) - 8;
+
+		switch (effect) {
+			case TRACE_NONE:
+				if ((opcode >> 12) == 0xA) text += std::sprintf(text, "I=%03X", opcode & 0x0FFF);
+				break;
+			case TRACE_VX: text += std::sprintf(text, "V%X=%02X", x, p[0]); break;
+			case TRACE_VX_VF: text += std::sprintf(text, "V%X=%02X VF=%02X", x, p[0], p[1]); break;
+			case TRACE_VF: text += std::sprintf(text, "VF=%02X", p[0]); break;
+			case TRACE_DT: text += std::sprintf(text, "DT=%02X", p[0]); break;
+			case TRACE_ST: text += std::sprintf(text, "ST=%02X", p[0]); break;
+			case TRACE_I: text += std::sprintf(text, "I=%03X", (p[0] << 8) | p[1]); break;
+			case TRACE_BCD:
+			case TRACE_STORE:
+				text += std::sprintf(text, "[%03X]=", (p[0] << 8) | p[1]);
+
+				for (std::ptrdiff_t i = 2; i < payload && text < limit; i++) {
+					text += std::sprintf(text, "%02X%s", p[i], i + 1 < payload ? " " : "");
+				}
+				break;
+			case TRACE_LOAD:
+				text += x ? std::sprintf(text, "V0-V%X=", x) : std::sprintf(text, "V0=");
+
+				for (std::ptrdiff_t i = 0; i < payload && text < limit; i++) {
+					text += std::sprintf(text, "%02X%s", p[i], i + 1 < payload ? " " : "");
+				}
+				break;
+		}
+
+		while (text > line && text[-1] == ' ') {
+			text--;
+		}
+
+		*text++ = '\n';
+		*text = '\0';
+		out << line;
+
+		p += payload;
+		lastPc = pc;
+	}
+}
@@ -0,0 +1,200 @@
+/*
+	eightplay CHIP-8 emulator
+
+	github.com/MrOnlineCoder/eightplay
+
+	MIT License
+
+	Copyright (c) 2018 Nikita Kogut (MrOnlineCoder)
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+
+#ifndef CHIP8TRACE_H
+#define CHIP8TRACE_H
+
+#include "Chip8.h"
+#include <atomic>
+#include <ostream>
+
+const std::size_t CHIP8_TRACE_BYTES = 16 * 1024 * 1024; //default ring size, a few million instructions
+const std::size_t CHIP8_TRACE_BLOCK_SIZE = 4096; //records never cross a block, so any block can be decoded on its own
+const std::size_t CHIP8_TRACE_MAX_RECORD = 32; //tag, pc, opcode and up to 18 bytes of changes
+
+const uint32_t CHIP8_TRACE_VERSION = 1;
+
+//Record tags
+const uint8_t CHIP8_TRACE_NEXT = 0; //instruction at the previous pc + 2: opcode, changes
+const uint8_t CHIP8_TRACE_AT = 1; //instruction anywhere else: pc, opcode, changes
+const uint8_t CHIP8_TRACE_IDLE = 2; //idle loop fast-forwarded by the block engine: pc, uint32 instructions
+
+//What an instruction changes, which is stored after its opcode
+enum Chip8TraceEffect {
+	TRACE_NONE, //control flow, skips, Annn and 00E0; the next record's pc shows where it went
+	TRACE_VX, //Vx
+	TRACE_VX_VF, //Vx, VF
+	TRACE_VF, //VF, the collision flag of Dxyn
+	TRACE_DT, //delay timer
+	TRACE_ST, //sound timer
+	TRACE_I, //uint16 I, for Fx1E and Fx29
+	TRACE_BCD, //uint16 I, the 3 bytes at I
+	TRACE_STORE, //uint16 I, the x + 1 bytes at I
+	TRACE_LOAD //V0 to Vx
+};
+
+/*
+	Execution trace recorder, compiled into Chip8 only with CHIP8_TRACE defined.
+
+	Each instruction run by the interpreter or the block engine adds a record
+	of a tag, the pc unless it directly follows the previous one, the opcode
+	and the values it changed, 4 bytes for a typical instruction. The JIT and
+	the static engine are not traced.
+
+	Records go into a ring of blocks which only the emulation thread writes.
+	copy() may run on any other thread without locks: it takes the published
+	blocks and drops those the writer reused in the meantime.
+
+	The offline side, decode(), prints a saved trace as a disassembly listing.
+*/
+class Chip8Tracer {
+public:
+	explicit Chip8Tracer(std::size_t bytes = CHIP8_TRACE_BYTES);
+
+	void instruction(uint16_t pc, Opcode opcode, const Chip8State& state); //after the instruction ran
+	void idle(uint16_t pc, unsigned long instructions);
+
+	void copy(std::vector<uint8_t>& out) const; //oldest block first, each as [uint32 size][records]
+	bool save(const std::string& filename) const;
+
+	static Chip8TraceEffect getEffect(Opcode opcode);
+	static std::string disassemble(Opcode opcode);
+	static bool decode(const std::string& filename, std::ostream& out);
+private:
+	uint8_t* reserve(); //room for the longest record in the current block
+	void nextBlock();
+
+	static void decodeBlock(const uint8_t* block, std::size_t size, std::ostream& out);
+
+	std::size_t blockCount;
+	std::vector<uint8_t> data;
+	std::vector<std::atomic<uint32_t>> blockSizes; //of finished blocks
+
+	std::atomic<uint64_t> block; //sequence number of the block being written, its slot is block % blockCount
+	std::atomic<uint32_t> fill; //bytes published in it
+
+	uint8_t* cursor;
+	uint8_t* blockStart;
+	uint32_t lastPc; //pc of the previous record, 0x10000 at the start of a block
+};
+
+inline uint8_t* Chip8Tracer::reserve() {
+	if (cursor + CHIP8_TRACE_MAX_RECORD > blockStart + CHIP8_TRACE_BLOCK_SIZE) {
+		nextBlock();
+	}
+
+	return cursor;
+}
+
+inline void Chip8Tracer::instruction(uint16_t pc, Opcode opcode, const Chip8State& state) {
+	uint8_t* p = reserve();
+
+	if (pc == lastPc + 2) {
+		*p++ = CHIP8_TRACE_NEXT;
+	} else {
+		*p++ = CHIP8_TRACE_AT;
+		*p++ = static_cast<uint8_t>(pc >> 8);
+		*p++ = static_cast<uint8_t>(pc);
+	}
+
+	*p++ = static_cast<uint8_t>(opcode >> 8);
+	*p++ = static_cast<uint8_t>(opcode);
+
+	const unsigned int x = (opcode & 0x0F00) >> 8;
+	const Chip8TraceEffect effect = getEffect(opcode);
+
+	switch (effect) {
+		case TRACE_NONE:
+			break;
+		case TRACE_VX:
+			*p++ = state.registers[x];
+			break;
+		case TRACE_VX_VF:
+			*p++ = state.registers[x];
+			*p++ = state.registers[CARRY_REGISTER];
+			break;
+		case TRACE_VF:
+			*p++ = state.registers[CARRY_REGISTER];
+			break;
+		case TRACE_DT:
+			*p++ = state.delayTimer;
+			break;
+		case TRACE_ST:
+			*p++ = state.soundTimer;
+			break;
+		case TRACE_I:
+		case TRACE_BCD:
+		case TRACE_STORE: {
+			*p++ = static_cast<uint8_t>(state.indexRegister >> 8);
+			*p++ = static_cast<uint8_t>(state.indexRegister);
+
+			unsigned int count = effect == TRACE_BCD ? 3 : effect == TRACE_STORE ? x + 1 : 0;
+
+			for (unsigned int i = 0; i < count; i++) {
+				*p++ = state.memory[(state.indexRegister + i) & 0x0FFF];
+			}
+			break;
+		}
+		case TRACE_LOAD:
+			for (unsigned int i = 0; i <= x; i++) {
+				*p++ = state.registers[i];
+			}
+			break;
+	}
+
+	cursor = p;
+	lastPc = pc;
+
+	fill.store(static_cast<uint32_t>(cursor - blockStart), std::memory_order_release);
+}
+
+inline Chip8TraceEffect Chip8Tracer::getEffect(Opcode opcode) {
+	switch (opcode >> 12) {
+		case 0x6: case 0x7: case 0xC:
+			return TRACE_VX;
+		case 0x8:
+			return (opcode & 0xF) <= 0x3 ? TRACE_VX : TRACE_VX_VF;
+		case 0xD:
+			return TRACE_VF;
+		case 0xF:
+			switch (opcode & 0xFF) {
+				case 0x07: case 0x0A: return TRACE_VX;
+				case 0x15: return TRACE_DT;
+				case 0x18: return TRACE_ST;
+				case 0x1E: case 0x29: return TRACE_I;
+				case 0x33: return TRACE_BCD;
+				case 0x55: return TRACE_STORE;
+				case 0x65: return TRACE_LOAD;
+			}
+			return TRACE_NONE;
+		default:
+			return TRACE_NONE;
+	}
+}
+
+#endif
@@ -26,114 +26,1093 @@
 	SOFTWARE.
 */
 #include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <thread>
 
 #include "Chip8.h"
+#include "Chip8Jit.h"
+#include "Chip8Aot.h"
+#include "Chip8Batch.h"
+#include "Chip8Lockstep.h"
+#include "Chip8Memo.h"
+#include "Chip8Movie.h"
+#include "Chip8Timeline.h"
+#include "Chip8Trace.h"
 
-int main(int argc, char* argv[]) {
+#ifndef CHIP8_HEADLESS
+#include "Chip8Frontend.h"
+#endif
 
-	if (argc < 2) {
-		std::cout << "eightplay CHIP-8 emulator by MrOnlineCoder" << std::endl << std::endl;
-		std::cout << "Usage: eightplay <file>" << std::endl;
-		std::cout << "- <file> - input CHIP-8 program to execute" << std::endl;
-		return 0;
+const unsigned long BENCHMARK_INSTRUCTIONS = 10000000ul;
+const unsigned long VERIFY_INSTRUCTIONS = 2000000ul;
+const int HEADLESS_CYCLES = 1000; //speed of headless runs, sets how often the timers tick
+const unsigned long RUN_FRAMES = 600; //default length of --run, 10 seconds of emulated time
+
+enum Engine {
+	ENGINE_INTERPRETER,
+	ENGINE_BLOCKS,
+	ENGINE_JIT,
+	ENGINE_MEMO,
+	ENGINE_STATIC,
+	ENGINE_COUNT
+};
+
+const char* ENGINE_NAMES[ENGINE_COUNT] = { "interpreter", "blocks", "jit", "memo", "static" };
+
+void printUsage() {
+	std::cout << "eightplay CHIP-8 emulator by MrOnlineCoder" << std::endl << std::endl;
+	std::cout << "Usage: eightplay <file> [speed] [seed] [--record-movie <movie> | --play-movie <movie>]" << std::endl;
+	std::cout << "       eightplay --run <file> [--frames N | --instructions N] [--speed N] [--seed N] [--load-state <in.state>] [--save-state <out.state>] [--record <timeline>] [--play-movie <movie>] [--trace <trace>] [--output <report.txt>] [--screen <screen.pbm>]" << std::endl;
+	std::cout << "       eightplay --trace-dump <trace>" << std::endl;
+	std::cout << "       eightplay --seek <timeline> <frame> [--save-state <out.state>] [--screen <screen.pbm>]" << std::endl;
+	std::cout << "       eightplay --batch [--frames N] [--speed N] [--seeds N] [--threads N] [--input <script>] [--jobs <list>] [file...]" << std::endl;
+	std::cout << "       eightplay --lockstep <file> [--lanes N] [--frames N] [--speed N] [--seed N]" << std::endl;
+	std::cout << "       eightplay --bench <file> [file...]" << std::endl;
+	std::cout << "       eightplay --verify <file> [file...]" << std::endl;
+	std::cout << "       eightplay --fusions <file> [file...]" << std::endl;
+	std::cout << "       eightplay --aot <file> <output.cpp>" << std::endl;
+	std::cout << "- <file> - input CHIP-8 program to execute" << std::endl;
+	std::cout << "- --run - run the program without a window until it halts or the limit is reached, then print the registers, screen and speed" << std::endl;
+	std::cout << "- --trace-dump - print a trace recorded with --run --trace as disassembly" << std::endl;
+	std::cout << "- --seek - restore a frame of a timeline recorded with --run --record and print it" << std::endl;
+	std::cout << "- --batch - run many programs and seeds on all cores and report the final state of each run" << std::endl;
+	std::cout << "- --lockstep - run the program on many seeds at once with the lockstep engine, compare with separate instances" << std::endl;
+	std::cout << "- --bench - run each program headless on every engine and report instructions per second" << std::endl;
+	std::cout << "- --verify - run each program on every engine and compare the final state with the interpreter" << std::endl;
+	std::cout << "- --fusions - run each program on the block engine and report which instruction pairs were fused" << std::endl;
+	std::cout << "- --aot - translate the program into C++ source which is built in as the static engine" << std::endl;
+}
+
+//Reads a whole decimal number into value, false for anything else, e.g. a sign, trailing characters or a number that does not fit
+template <typename T>
+bool parseNumber(const std::string& text, T& value) {
+	if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) {
+		return false;
 	}
 
-	Chip8 chip8;
+	errno = 0;
+	unsigned long long number = std::strtoull(text.c_str(), nullptr, 10);
+
+	if (errno == ERANGE || number > static_cast<unsigned long long>(std::numeric_limits<T>::max())) {
+		return false;
+	}
+
+	value = static_cast<T>(number);
+	return true;
+}
+
+//Reports a value parseNumber() rejected, returns the exit code
+int invalidValue(const std::string& option, const std::string& value) {
+	std::cerr << "Error: invalid value " << value << " for " << option << std::endl << std::endl;
+	printUsage();
+	return 1;
+}
+
+struct BenchmarkResult {
+	unsigned long instructions = 0;
+	double seconds = 0.0;
+};
 
-	if (argc == 3) {
-		int cycles = std::stoi(argv[2]);
+double toMips(const BenchmarkResult& result) {
+	return result.seconds > 0.0 ? result.instructions / result.seconds / 1000000.0 : 0.0;
+}
 
-		chip8.setCycles(cycles);
+//Runs about maxInstructions on the given engine and returns how many were executed
+unsigned long runEngine(Chip8& chip8, Engine engine, unsigned long maxInstructions) {
+	if (engine == ENGINE_STATIC) {
+		Chip8StaticRuntime runtime(chip8, *Chip8Aot::findProgram(chip8));
+		return runtime.execute(maxInstructions);
 	}
 
-	if (!chip8.loadFromFile(std::string(argv[1]))) {
-		std::cerr << "Error: failed to load file " << argv[1] << std::endl;
-		return 1;
+	if (engine == ENGINE_JIT) {
+		Chip8Jit jit(chip8);
+		return jit.execute(maxInstructions);
 	}
 
-	sf::RenderWindow window;
-	window.create(sf::VideoMode(1024,768), "eightplay", sf::Style::Titlebar | sf::Style::Close);
+	if (engine == ENGINE_MEMO) {
+		Chip8Memo memo(chip8);
+		return memo.execute(maxInstructions);
+	}
 
-	chip8.prepare(window);
+	if (engine == ENGINE_BLOCKS) {
+		return chip8.executeBlocks(maxInstructions);
+	}
 
-	window.setTitle("eightplay ROM: "+std::string(argv[1])+" Cycles: "+std::to_string(chip8.getCycles()));
+	return chip8.executeInstructions(maxInstructions);
+}
 
-	sf::Font fnt;
-	if (!fnt.loadFromFile("opensans.ttf")) {
-		std::cerr << "Error: failed to load opensans font!" << std::endl;
-		return 2;
+//The static engine only exists for ROMs compiled in with --aot
+bool isEngineAvailable(const Chip8& chip8, Engine engine) {
+	return engine != ENGINE_STATIC || Chip8Aot::findProgram(chip8) != nullptr;
+}
+
+bool benchmarkRom(const std::string& filename, Engine engine, BenchmarkResult& result) {
+	Chip8 chip8;
+
+	if (!chip8.loadFromFile(filename)) {
+		return false;
 	}
 
-	window.setFramerateLimit(chip8.getCycles());
+	chip8.setCycles(HEADLESS_CYCLES);
+	chip8.prepare();
 
-	chip8.errText.setFont(fnt);
-	chip8.errText.setCharacterSize(21);
-	chip8.errText.setPosition(10, 10);
-	chip8.errText.setFillColor(sf::Color::Yellow);
+	if (!isEngineAvailable(chip8, engine)) {
+		return true;
+	}
 
-	chip8.debugText.setFont(fnt);
-	chip8.debugText.setCharacterSize(18);
+	//Same random numbers on every engine, so they all run the same path
+	chip8.seedRandom(1);
 
-	chip8.updateDebugText();
+	auto start = std::chrono::steady_clock::now();
 
-	const int PIXEL_SIZE = (int)window.getSize().x / CHIP8_SCREEN_WIDTH;
+	result.instructions = runEngine(chip8, engine, BENCHMARK_INSTRUCTIONS);
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-	sf::RectangleShape pixel;
-	pixel.setOutlineColor(sf::Color::White);
-	pixel.setOutlineThickness(0.0f);
-	pixel.setSize(sf::Vector2f(PIXEL_SIZE, PIXEL_SIZE));
+	return true;
+}
 
-	while (window.isOpen()) {
-		sf::Event evt;
-		while (window.pollEvent(evt)) {
-			if (evt.type == sf::Event::Closed) {
-				window.close();
-			}
+//Runs every given ROM without a window on each engine and reports the speed in MIPS
+int runBenchmark(int argc, char* argv[]) {
+	BenchmarkResult totals[ENGINE_COUNT];
+
+	for (int i = 2; i < argc; i++) {
+		std::cout << std::left << std::setw(48) << argv[i] << std::right;
 
-			if (evt.type == sf::Event::KeyPressed) {
-				chip8.processKeyPress(evt);
-				chip8.updateDebugText();
-				continue;
+		for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+			BenchmarkResult result;
+
+			if (!benchmarkRom(argv[i], static_cast<Engine>(engine), result)) {
+				std::cerr << "Error: failed to load file " << argv[i] << std::endl;
+				return 1;
 			}
 
-			if (evt.type == sf::Event::KeyReleased) {
-				if (evt.key.code == sf::Keyboard::F3) {
-					chip8.setRunning(!chip8.isRunning());
-					continue;
-				}
-
-				if (!chip8.isRunning() && evt.key.code == sf::Keyboard::F2) {
-					chip8.execute();
-					chip8.updateDebugText();
-					continue;
-				}
-
-				chip8.processKeyRelease(evt);
-				chip8.updateDebugText();
-				continue;
+			if (result.instructions == 0) continue;
+
+			std::cout << " " << ENGINE_NAMES[engine] << ": "
+				<< std::setw(10) << result.instructions << " instructions "
+				<< std::fixed << std::setprecision(2) << std::setw(8) << toMips(result) << " MIPS";
+
+			totals[engine].instructions += result.instructions;
+			totals[engine].seconds += result.seconds;
+		}
+
+		std::cout << std::endl;
+	}
+
+	for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+		std::cout << "Total " << ENGINE_NAMES[engine] << ": " << totals[engine].instructions << " instructions, "
+			<< std::fixed << std::setprecision(2) << toMips(totals[engine]) << " MIPS" << std::endl;
+	}
+
+	return 0;
+}
+
+//Runs every given ROM on each engine and compares the final state with the interpreter
+int runVerify(int argc, char* argv[]) {
+	int failures = 0;
+
+	for (int i = 2; i < argc; i++) {
+		for (int engine = ENGINE_BLOCKS; engine < ENGINE_COUNT; engine++) {
+			Chip8 tested;
+			Chip8 reference;
+
+			if (!tested.loadFromFile(argv[i]) || !reference.loadFromFile(argv[i])) {
+				std::cerr << "Error: failed to load file " << argv[i] << std::endl;
+				return 1;
 			}
+
+			tested.setCycles(HEADLESS_CYCLES);
+			reference.setCycles(HEADLESS_CYCLES);
+
+			tested.prepare();
+			reference.prepare();
+
+			if (!isEngineAvailable(tested, static_cast<Engine>(engine))) continue;
+
+			tested.seedRandom(1);
+			unsigned long executed = runEngine(tested, static_cast<Engine>(engine), VERIFY_INSTRUCTIONS);
+
+			reference.seedRandom(1);
+			runEngine(reference, ENGINE_INTERPRETER, executed);
+
+			bool same = tested.hasSameState(reference);
+
+			std::cout << (same ? "OK       " : "MISMATCH ") << std::left << std::setw(12) << ENGINE_NAMES[engine] << std::right
+				<< std::setw(10) << executed << " instructions  " << argv[i] << std::endl;
+
+			if (!same) failures++;
+		}
+	}
+
+	std::cout << failures << " mismatches" << std::endl;
+
+	return failures == 0 ? 0 : 1;
+}
+
+//Runs every given ROM on the block engine and reports how often each instruction pair ran fused
+int runFusionStats(int argc, char* argv[]) {
+	for (int i = 2; i < argc; i++) {
+		Chip8 chip8;
+
+		if (!chip8.loadFromFile(argv[i])) {
+			std::cerr << "Error: failed to load file " << argv[i] << std::endl;
+			return 1;
+		}
+
+		chip8.setCycles(HEADLESS_CYCLES);
+		chip8.prepare();
+
+		unsigned long executed = runEngine(chip8, ENGINE_BLOCKS, BENCHMARK_INSTRUCTIONS);
+
+		std::cout << argv[i] << ": " << executed << " instructions" << std::endl;
+
+		for (int fusion = 0; fusion < FUSION_COUNT; fusion++) {
+			unsigned long count = chip8.getFusionCount(static_cast<Chip8Fusion>(fusion));
+
+			std::cout << "  " << std::left << std::setw(16) << CHIP8_FUSION_NAMES[fusion] << std::right
+				<< std::setw(10) << count << " (" << std::fixed << std::setprecision(2)
+				<< (executed ? 200.0 * count / executed : 0.0) << "% of instructions)" << std::endl;
 		}
+	}
+
+	return 0;
+}
 
-		chip8.update();
+//Writes the registers, timers and stack as text
+void writeState(const Chip8State& state, std::ostream& out) {
+	out << std::hex << std::uppercase << std::setfill('0')
+		<< "PC " << std::setw(3) << state.pc << "  I " << std::setw(3) << state.indexRegister
+		<< "  SP " << state.sp << "  DT " << std::setw(2) << (int) state.delayTimer
+		<< "  ST " << std::setw(2) << (int) state.soundTimer << "\n";
 
-		window.clear();
+	for (unsigned int r = 0; r < CHIP8_REGISTERS; r++) {
+		if (r % 8 == 0) out << (r ? "V8-VF" : "V0-V7");
+		out << " " << std::setw(2) << (int) state.registers[r];
+		if (r % 8 == 7) out << "\n";
+	}
+
+	out << "Stack";
+	for (unsigned int i = 0; i < state.sp && i < CHIP8_STACK_SIZE; i++) {
+		out << " " << std::setw(3) << state.stack[i];
+	}
 
+	out << std::dec << std::nouppercase << std::setfill(' ') << "\n";
+}
+
+//Writes the screen as text, one line per row
+void writeScreen(const Chip8State& state, std::ostream& out) {
+	for (int y = 0; y < CHIP8_SCREEN_HEIGHT; y++) {
 		for (int x = 0; x < CHIP8_SCREEN_WIDTH; x++) {
-			for (int y = 0; y < CHIP8_SCREEN_HEIGHT; y++) {
-				if (!chip8.screen[x][y]) continue;
-				
-				pixel.setFillColor(chip8.screen[x][y] ? sf::Color::White : sf::Color::Black);
-				pixel.setPosition(x * PIXEL_SIZE, y * PIXEL_SIZE);
-				window.draw(pixel);
+			out << ((state.screen[y] >> (CHIP8_SCREEN_WIDTH - 1 - x)) & 1 ? '#' : '.');
+		}
+
+		out << "\n";
+	}
+}
+
+//Writes the screen as a binary PBM image, whose rows are packed most significant bit first like screen rows
+bool writeScreenImage(const Chip8State& state, const std::string& filename) {
+	std::ofstream file(filename, std::ios::binary);
+
+	file << "P4\n" << CHIP8_SCREEN_WIDTH << " " << CHIP8_SCREEN_HEIGHT << "\n";
+
+	for (int y = 0; y < CHIP8_SCREEN_HEIGHT; y++) {
+		for (int shift = CHIP8_SCREEN_WIDTH - 8; shift >= 0; shift -= 8) {
+			file.put(static_cast<char>(state.screen[y] >> shift));
+		}
+	}
+
+	return static_cast<bool>(file);
+}
+
+//Loads a movie and checks that it was recorded on the loaded ROM
+bool loadMovie(const std::string& filename, const Chip8& chip8, Chip8Movie& movie) {
+	if (!movie.load(filename)) {
+		std::cerr << "Error: failed to load movie " << filename << std::endl;
+		return false;
+	}
+
+	if (movie.getRomHash() != chip8.getRomHash()) {
+		std::cerr << "Error: " << filename << " was recorded on another ROM" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+	Runs a ROM without a window for a number of frames or instructions, or until
+	it halts (stops or jumps to itself), then reports how it stopped, the run
+	statistics, the final registers and the screen.
+	Returns 1 if the machine stopped on an error, e.g. an unknown opcode.
+*/
+int runHeadless(int argc, char* argv[]) {
+	if (argc < 3) {
+		std::cerr << "Error: --run expects a ROM" << std::endl;
+		return 1;
+	}
+
+	unsigned long maxFrames = RUN_FRAMES;
+	unsigned long maxInstructions = 0; //frame limit is used if 0
+	int speed = HEADLESS_CYCLES;
+	uint64_t seed = 1;
+	std::string screenFile;
+	std::string outputFile;
+	std::string loadStateFile;
+	std::string saveStateFile;
+	std::string recordFile;
+	std::string playMovieFile;
+	std::string traceFile;
+	bool framesGiven = false;
+
+	for (int i = 3; i < argc; i += 2) {
+		std::string option = argv[i];
+
+		if (i + 1 >= argc) {
+			std::cerr << "Error: " << option << " expects a value" << std::endl;
+			return 1;
+		}
+
+		std::string value = argv[i + 1];
+
+		if (option == "--frames") {
+			if (!parseNumber(value, maxFrames)) return invalidValue(option, value);
+			maxInstructions = 0;
+			framesGiven = true;
+		} else if (option == "--instructions") {
+			if (!parseNumber(value, maxInstructions)) return invalidValue(option, value);
+		} else if (option == "--speed") {
+			if (!parseNumber(value, speed)) return invalidValue(option, value);
+		} else if (option == "--seed") {
+			if (!parseNumber(value, seed)) return invalidValue(option, value);
+		} else if (option == "--screen") {
+			screenFile = value;
+		} else if (option == "--output") {
+			outputFile = value;
+		} else if (option == "--load-state") {
+			loadStateFile = value;
+		} else if (option == "--save-state") {
+			saveStateFile = value;
+		} else if (option == "--record") {
+			recordFile = value;
+		} else if (option == "--play-movie") {
+			playMovieFile = value;
+		} else if (option == "--trace") {
+			traceFile = value;
+		} else {
+			std::cerr << "Error: unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	Chip8 chip8;
+
+	if (!chip8.loadFromFile(argv[2])) {
+		std::cerr << "Error: failed to load file " << argv[2] << std::endl;
+		return 1;
+	}
+
+	Chip8Movie movie;
+
+	if (!playMovieFile.empty()) {
+		//A movie replays from power on, frame by frame
+		if (maxInstructions || !loadStateFile.empty()) {
+			std::cerr << "Error: --play-movie cannot be used with --instructions or --load-state" << std::endl;
+			return 1;
+		}
+
+		if (!loadMovie(playMovieFile, chip8, movie)) {
+			return 1;
+		}
+
+		speed = movie.getCycles();
+		seed = movie.getSeed();
+
+		if (!framesGiven) maxFrames = movie.getFrameCount();
+	}
+
+	chip8.setCycles(speed > 0 ? speed : HEADLESS_CYCLES);
+	chip8.prepare();
+
+	chip8.seedRandom(seed);
+
+	//Resume from a checkpoint instead of the start of the ROM
+	if (!loadStateFile.empty() && !chip8.loadStateFromFile(loadStateFile)) {
+		std::cerr << "Error: failed to load state " << loadStateFile << std::endl;
+		return 1;
+	}
+
+#ifdef CHIP8_TRACE
+	std::unique_ptr<Chip8Tracer> tracer;
+
+	if (!traceFile.empty()) {
+		tracer.reset(new Chip8Tracer());
+		chip8.setTracer(tracer.get());
+	}
+#else
+	if (!traceFile.empty()) {
+		std::cerr << "Error: this build has no tracer, rebuild with CHIP8_TRACE defined" << std::endl;
+		return 1;
+	}
+#endif
+
+	Chip8TimelineWriter timeline;
+
+	if (!recordFile.empty() && !timeline.open(recordFile)) {
+		std::cerr << "Error: failed to write " << recordFile << std::endl;
+		return 1;
+	}
+
+	unsigned long executed = 0;
+	unsigned long frames = 0;
+
+	auto start = std::chrono::steady_clock::now();
+
+	if (maxInstructions) {
+		//Cut into frames, so a halt is noticed soon after it happens
+		const unsigned long chunk = std::max(1, chip8.getCycles() / static_cast<int>(CHIP8_CLOCK_SPEED));
+
+		while (executed < maxInstructions && !chip8.isHalted()) {
+			if (timeline.isOpen()) timeline.append(chip8.state);
+
+			executed += chip8.executeBlocks(std::min(maxInstructions - executed, chunk));
+		}
+	} else {
+		while (frames < maxFrames && !chip8.isHalted()) {
+			if (!playMovieFile.empty()) chip8.setKeys(movie.getKeys(frames));
+			if (timeline.isOpen()) timeline.append(chip8.state);
+
+			executed += chip8.runFrame();
+			frames++;
+		}
+	}
+
+	if (!recordFile.empty() && !timeline.isOpen()) {
+		std::cerr << "Error: failed to write " << recordFile << std::endl;
+		return 1;
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::ofstream outputStream;
+
+	if (!outputFile.empty()) {
+		outputStream.open(outputFile);
+
+		if (!outputStream) {
+			std::cerr << "Error: failed to write " << outputFile << std::endl;
+			return 1;
+		}
+	}
+
+	std::ostream& out = outputFile.empty() ? std::cout : outputStream;
+
+	out << "ROM: " << argv[2] << "\n";
+
+	if (chip8.hasError()) {
+		out << "Stopped: " << chip8.getErrorMessage();
+		if (chip8.getErrorMessage().back() != '\n') out << "\n";
+	} else if (chip8.isHalted()) {
+		out << "Stopped: jump to itself at 0x" << std::hex << std::uppercase << chip8.state.pc << std::dec << std::nouppercase << "\n";
+	} else {
+		out << "Stopped: limit reached\n";
+	}
+
+	out << "Instructions: " << executed << "\n";
+	if (!maxInstructions) out << "Frames: " << frames << "\n";
+	out << "Time: " << std::fixed << std::setprecision(3) << seconds << " s\n";
+	out << "Speed: " << std::setprecision(2) << (seconds > 0.0 ? executed / seconds / 1000000.0 : 0.0) << " MIPS\n";
+
+	writeState(chip8.state, out);
+	writeScreen(chip8.state, out);
+
+	if (!screenFile.empty() && !writeScreenImage(chip8.state, screenFile)) {
+		std::cerr << "Error: failed to write " << screenFile << std::endl;
+		return 1;
+	}
+
+	if (!saveStateFile.empty() && !chip8.saveStateToFile(saveStateFile)) {
+		std::cerr << "Error: failed to write " << saveStateFile << std::endl;
+		return 1;
+	}
+
+#ifdef CHIP8_TRACE
+	if (tracer && !tracer->save(traceFile)) {
+		std::cerr << "Error: failed to write " << traceFile << std::endl;
+		return 1;
+	}
+#endif
+
+	return chip8.hasError() ? 1 : 0;
+}
+
+//Prints a trace saved by --run --trace as a disassembly listing
+int runTraceDump(int argc, char* argv[]) {
+	if (argc != 3) {
+		std::cerr << "Error: --trace-dump expects a trace file" << std::endl;
+		return 1;
+	}
+
+	if (!Chip8Tracer::decode(argv[2], std::cout)) {
+		std::cerr << "Error: failed to load trace " << argv[2] << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+	Restores the state at a frame of a timeline recorded by --run --record,
+	then reports it like --run and optionally saves it, so the run can be
+	continued from there with --run --load-state.
+*/
+int runSeek(int argc, char* argv[]) {
+	if (argc < 4) {
+		std::cerr << "Error: --seek expects a timeline and a frame" << std::endl;
+		return 1;
+	}
+
+	unsigned long frame = 0;
+
+	if (!parseNumber(argv[3], frame)) {
+		return invalidValue("--seek", argv[3]);
+	}
+
+	std::string screenFile;
+	std::string saveStateFile;
+
+	for (int i = 4; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+
+		if (option == "--screen") {
+			screenFile = argv[i + 1];
+		} else if (option == "--save-state") {
+			saveStateFile = argv[i + 1];
+		} else {
+			std::cerr << "Error: unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	Chip8TimelineReader timeline;
+
+	if (!timeline.open(argv[2])) {
+		std::cerr << "Error: failed to load timeline " << argv[2] << std::endl;
+		return 1;
+	}
+
+	Chip8 chip8;
+	Chip8State state;
+
+	auto start = std::chrono::steady_clock::now();
+
+	if (!timeline.seek(frame, state)) {
+		std::cerr << "Error: frame " << frame << " is not in the timeline, it has " << timeline.getFrameCount() << " frames" << std::endl;
+		return 1;
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	chip8.loadState(state);
+
+	std::cout << "Timeline: " << argv[2] << "\n";
+	std::cout << "Frame: " << frame << " of " << timeline.getFrameCount() << "\n";
+	std::cout << "Seek time: " << std::fixed << std::setprecision(3) << seconds * 1000.0 << " ms\n";
+
+	writeState(chip8.state, std::cout);
+	writeScreen(chip8.state, std::cout);
+
+	if (!screenFile.empty() && !writeScreenImage(chip8.state, screenFile)) {
+		std::cerr << "Error: failed to write " << screenFile << std::endl;
+		return 1;
+	}
+
+	if (!saveStateFile.empty() && !chip8.saveStateToFile(saveStateFile)) {
+		std::cerr << "Error: failed to write " << saveStateFile << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+	Runs every ROM with each of the seeds, plus the jobs of a job list, on all
+	cores, then reports the final state of every run and the total speed.
+	A job list has one "<rom>\t<seed>\t<input script>" line per job, seed and
+	script are optional.
+*/
+int runBatch(int argc, char* argv[]) {
+	unsigned long maxFrames = RUN_FRAMES;
+	unsigned long seeds = 1;
+	int speed = HEADLESS_CYCLES;
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+	std::string inputFile;
+	std::string jobsFile;
+	std::vector<std::string> files;
+
+	for (int i = 2; i < argc; i++) {
+		std::string arg = argv[i];
+
+		if (arg.compare(0, 2, "--") != 0) {
+			files.push_back(arg);
+			continue;
+		}
+
+		if (i + 1 >= argc) {
+			std::cerr << "Error: " << arg << " expects a value" << std::endl;
+			return 1;
+		}
+
+		std::string value = argv[++i];
+
+		if (arg == "--frames") {
+			if (!parseNumber(value, maxFrames)) return invalidValue(arg, value);
+		} else if (arg == "--seeds") {
+			if (!parseNumber(value, seeds)) return invalidValue(arg, value);
+			seeds = std::max(1ul, seeds);
+		} else if (arg == "--speed") {
+			if (!parseNumber(value, speed)) return invalidValue(arg, value);
+		} else if (arg == "--threads") {
+			if (!parseNumber(value, threads)) return invalidValue(arg, value);
+			threads = std::max(1u, threads);
+		} else if (arg == "--input") {
+			inputFile = value;
+		} else if (arg == "--jobs") {
+			jobsFile = value;
+		} else {
+			std::cerr << "Error: unknown option " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	//Loaded once and shared read-only by all jobs
+	std::map<std::string, std::vector<uint8_t>> roms;
+	std::map<std::string, std::vector<Chip8InputEvent>> scripts;
+
+	auto getRom = [&](const std::string& filename) -> const std::vector<uint8_t>* {
+		auto it = roms.find(filename);
+		if (it != roms.end()) return &it->second;
+
+		std::vector<uint8_t> rom;
+		if (!Chip8Batch::loadRom(filename, rom)) {
+			std::cerr << "Error: failed to load file " << filename << std::endl;
+			return nullptr;
+		}
+
+		return &(roms[filename] = rom);
+	};
+
+	auto getScript = [&](const std::string& filename) -> const std::vector<Chip8InputEvent>* {
+		auto it = scripts.find(filename);
+		if (it != scripts.end()) return &it->second;
+
+		std::vector<Chip8InputEvent> events;
+		if (!Chip8Batch::loadInputScript(filename, events)) {
+			std::cerr << "Error: failed to load input script " << filename << std::endl;
+			return nullptr;
+		}
+
+		return &(scripts[filename] = events);
+	};
+
+	Chip8Batch batch(speed > 0 ? speed : HEADLESS_CYCLES, maxFrames);
+
+	const std::vector<Chip8InputEvent>* input = nullptr;
+
+	if (!inputFile.empty() && !(input = getScript(inputFile))) {
+		return 1;
+	}
+
+	for (const auto& file : files) {
+		const std::vector<uint8_t>* rom = getRom(file);
+		if (!rom) return 1;
+
+		for (unsigned long seed = 1; seed <= seeds; seed++) {
+			batch.add({ file, rom, seed, input });
+		}
+	}
+
+	if (!jobsFile.empty()) {
+		std::ifstream list(jobsFile);
+
+		if (!list) {
+			std::cerr << "Error: failed to load file " << jobsFile << std::endl;
+			return 1;
+		}
+
+		std::string line;
+		while (std::getline(list, line)) {
+			if (line.empty() || line[0] == '#') continue;
+
+			std::istringstream fields(line);
+			std::string file, seed, script;
+
+			std::getline(fields, file, '\t');
+			std::getline(fields, seed, '\t');
+			std::getline(fields, script, '\t');
+
+			const std::vector<uint8_t>* rom = getRom(file);
+			if (!rom) return 1;
+
+			const std::vector<Chip8InputEvent>* jobInput = input;
+			if (!script.empty() && !(jobInput = getScript(script))) return 1;
+
+			unsigned long jobSeed = 1;
+
+			if (!seed.empty() && !parseNumber(seed, jobSeed)) {
+				std::cerr << "Error: invalid seed " << seed << " in " << jobsFile << std::endl;
+				return 1;
 			}
+
+			batch.add({ file, rom, jobSeed, jobInput });
+		}
+	}
+
+	if (batch.getJobs().empty()) {
+		std::cerr << "Error: --batch expects ROMs or a job list" << std::endl;
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	batch.run(threads);
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	unsigned long instructions = 0;
+	unsigned long halted = 0;
+	unsigned long looped = 0;
+	unsigned long errors = 0;
+
+	const auto& jobs = batch.getJobs();
+	const auto& results = batch.getResults();
+
+	std::cout << std::setfill('0') << std::hex << std::uppercase;
+
+	for (std::size_t i = 0; i < jobs.size(); i++) {
+		const Chip8BatchResult& result = results[i];
+
+		std::cout << (result.error ? "ERROR  " : result.halted ? "HALTED " : result.loopPeriod ? "LOOP   " : "OK     ")
+			<< "screen " << std::setw(16) << result.screenHash << " state " << std::setw(16) << result.stateHash
+			<< " pc " << std::setw(3) << result.pc << std::dec
+			<< " seed " << jobs[i].seed << " " << result.instructions << " instructions " << result.frames << " frames";
+
+		if (result.loopPeriod && !result.halted) {
+			std::cout << " (loop of " << result.loopPeriod << ")";
+		}
+
+		std::cout << "  " << jobs[i].name << std::hex << "\n";
+
+		instructions += result.instructions;
+		if (result.halted) halted++;
+		else if (result.loopPeriod) looped++;
+		if (result.error) errors++;
+	}
+
+	std::cout << std::dec << std::nouppercase << std::setfill(' ');
+
+	std::cout << jobs.size() << " jobs, " << halted << " halted, " << looped << " looping, " << errors << " errors, "
+		<< instructions << " instructions in " << std::fixed << std::setprecision(3) << seconds << " s, "
+		<< std::setprecision(2) << (seconds > 0.0 ? instructions / seconds / 1000000.0 : 0.0) << " MIPS on "
+		<< threads << " threads, " << batch.getSteals() << " jobs stolen" << std::endl;
+
+	return errors == 0 ? 0 : 1;
+}
+
+/*
+	Runs a ROM on lanes differing only in their random seed (the first seed,
+	then the next ones), once with
+	Chip8Lockstep and once as separate Chip8 instances on the block engine.
+	Reports both speeds and checks that every lane ends in the same state.
+*/
+int runLockstep(int argc, char* argv[]) {
+	if (argc < 3) {
+		std::cerr << "Error: --lockstep expects a ROM" << std::endl;
+		return 1;
+	}
+
+	unsigned int lanes = 64;
+	unsigned long frames = RUN_FRAMES;
+	int speed = HEADLESS_CYCLES;
+	uint64_t seed = 1;
+
+	for (int i = 3; i + 1 < argc; i += 2) {
+		std::string option = argv[i];
+
+		std::string value = argv[i + 1];
+
+		if (option == "--lanes") {
+			if (!parseNumber(value, lanes)) return invalidValue(option, value);
+			lanes = std::max(1u, lanes);
+		} else if (option == "--frames") {
+			if (!parseNumber(value, frames)) return invalidValue(option, value);
+		} else if (option == "--speed") {
+			if (!parseNumber(value, speed)) return invalidValue(option, value);
+			speed = std::max(1, speed);
+		} else if (option == "--seed") {
+			if (!parseNumber(value, seed)) return invalidValue(option, value);
+		} else {
+			std::cerr << "Error: unknown option " << option << std::endl;
+			return 1;
 		}
+	}
+
+	std::vector<uint8_t> rom;
+
+	if (!Chip8Batch::loadRom(argv[2], rom)) {
+		std::cerr << "Error: failed to load file " << argv[2] << std::endl;
+		return 1;
+	}
 
-		if (chip8.error) window.draw(chip8.errText);
+	Chip8Lockstep lockstep(lanes);
+	lockstep.setCycles(speed);
+	lockstep.loadFromMemory(rom.data(), rom.size());
 
-		window.draw(chip8.debugText);
-		window.display();
+	for (unsigned int lane = 0; lane < lanes; lane++) {
+		lockstep.seedRandom(lane, seed + lane);
 	}
 
+	unsigned long lockstepInstructions = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned long frame = 0; frame < frames; frame++) {
+		lockstepInstructions += lockstep.runFrame();
+	}
+
+	double lockstepSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	unsigned long separateInstructions = 0;
+	double separateSeconds = 0.0;
+	unsigned int mismatches = 0;
+
+	std::unique_ptr<Chip8> chip8(new Chip8());
+	Chip8State laneState;
+
+	for (unsigned int lane = 0; lane < lanes; lane++) {
+		chip8.reset(new Chip8());
+		chip8->loadFromMemory(rom.data(), rom.size());
+		chip8->setCycles(speed);
+		chip8->prepare();
+		chip8->seedRandom(seed + lane);
+
+		start = std::chrono::steady_clock::now();
+
+		for (unsigned long frame = 0; frame < frames; frame++) {
+			separateInstructions += chip8->runFrame();
+		}
+
+		separateSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		//Chip8State has no padding, so equal bytes are equal states
+		lockstep.getState(lane, laneState);
+
+		if (std::memcmp(&laneState, &chip8->state, sizeof(Chip8State)) != 0) {
+			std::cout << "MISMATCH lane " << lane << std::endl;
+			mismatches++;
+		}
+	}
+
+	std::cout << std::fixed << std::setprecision(2)
+		<< "Lockstep: " << lanes << " lanes, " << lockstepInstructions << " instructions, "
+		<< (lockstepSeconds > 0.0 ? lockstepInstructions / lockstepSeconds / 1000000.0 : 0.0) << " MIPS, "
+		<< lockstep.getVectorSteps() << " opcodes on groups of lanes, " << lockstep.getScalarSteps() << " on single lanes, "
+		<< lockstep.getSeparateInstructions() << " instructions on separate lanes" << std::endl
+		<< "Separate: " << lanes << " instances, " << separateInstructions << " instructions, "
+		<< (separateSeconds > 0.0 ? separateInstructions / separateSeconds / 1000000.0 : 0.0) << " MIPS" << std::endl
+		<< mismatches << " mismatches" << std::endl;
+
+	return mismatches == 0 ? 0 : 1;
+}
+
+//Translates a ROM into a C++ file which is built into eightplay as the static engine
+int runAot(int argc, char* argv[]) {
+	if (argc != 4) {
+		std::cerr << "Error: --aot expects an input ROM and an output file" << std::endl;
+		return 1;
+	}
+
+	std::ifstream input(argv[2], std::ios::binary);
+
+	if (!input) {
+		std::cerr << "Error: failed to load file " << argv[2] << std::endl;
+		return 1;
+	}
+
+	std::vector<uint8_t> rom((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+	std::string name = argv[2];
+	std::size_t slash = name.find_last_of("/\\");
+	if (slash != std::string::npos) name = name.substr(slash + 1);
+
+	std::ofstream output(argv[3]);
+
+	if (!output || !Chip8Aot::generate(rom, name, output)) {
+		std::cerr << "Error: failed to write " << argv[3] << std::endl;
+		return 1;
+	}
+
+	std::cout << "Written " << argv[3] << ", add it to the project (with the eightplay sources on the include path) to use the static engine for " << name << std::endl;
+
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+
+	if (argc < 2) {
+		printUsage();
+		return 0;
+	}
+
+	if (std::string(argv[1]) == "--run") {
+		return runHeadless(argc, argv);
+	}
+
+	if (std::string(argv[1]) == "--trace-dump") {
+		return runTraceDump(argc, argv);
+	}
+
+	if (std::string(argv[1]) == "--seek") {
+		return runSeek(argc, argv);
+	}
+
+	if (std::string(argv[1]) == "--batch") {
+		return runBatch(argc, argv);
+	}
+
+	if (std::string(argv[1]) == "--lockstep") {
+		return runLockstep(argc, argv);
+	}
+
+	if (std::string(argv[1]) == "--bench") {
+		return runBenchmark(argc, argv);
+	}
+
+	if (std::string(argv[1]) == "--verify") {
+		return runVerify(argc, argv);
+	}
+
+	if (std::string(argv[1]) == "--fusions") {
+		return runFusionStats(argc, argv);
+	}
+
+	if (std::string(argv[1]) == "--aot") {
+		return runAot(argc, argv);
+	}
+
+	Chip8 chip8;
+
+	if (!chip8.loadFromFile(std::string(argv[1]))) {
+		std::cerr << "Error: failed to load file " << argv[1] << std::endl;
+		return 1;
+	}
+
+	//A new game every time, unless a seed is given to replay one
+	uint64_t seed = static_cast<uint64_t>(std::time(0));
+	std::string recordMovieFile;
+	std::string playMovieFile;
+
+	int arg = 2;
+
+	if (arg < argc && argv[arg][0] != '-') {
+		int speed = 0;
+
+		if (!parseNumber(argv[arg], speed)) {
+			return invalidValue("speed", argv[arg]);
+		}
+
+		chip8.setCycles(speed);
+		arg++;
+	}
+
+	if (arg < argc && argv[arg][0] != '-') {
+		if (!parseNumber(argv[arg], seed)) {
+			return invalidValue("seed", argv[arg]);
+		}
+
+		arg++;
+	}
+
+	for (; arg < argc; arg += 2) {
+		std::string option = argv[arg];
+
+		if (arg + 1 >= argc) {
+			std::cerr << "Error: " << option << " expects a value" << std::endl;
+			return 1;
+		}
+
+		if (option == "--record-movie") {
+			recordMovieFile = argv[arg + 1];
+		} else if (option == "--play-movie") {
+			playMovieFile = argv[arg + 1];
+		} else {
+			std::cerr << "Error: unknown option " << option << std::endl;
+			return 1;
+		}
+	}
+
+	Chip8Movie movie;
+
+	if (!playMovieFile.empty() && !loadMovie(playMovieFile, chip8, movie)) {
+		return 1;
+	}
+
+	if (!playMovieFile.empty()) {
+		chip8.setCycles(movie.getCycles());
+		seed = movie.getSeed();
+	}
+
+	chip8.seedRandom(seed);
+
+#ifdef CHIP8_HEADLESS
+	std::cerr << "Error: this build has no window, use --run, --trace-dump, --seek, --batch, --lockstep, --bench, --verify, --fusions or --aot" << std::endl;
+	return 1;
+#else
+	chip8.prepare();
+
+	sf::RenderWindow window;
+	window.create(sf::VideoMode(1024,768), "eightplay", sf::Style::Titlebar | sf::Style::Close);
+
+	window.setTitle("eightplay ROM: "+std::string(argv[1])+" Cycles: "+std::to_string(chip8.getCycles()));
+
+	sf::Font fnt;
+	if (!fnt.loadFromFile("opensans.ttf")) {
+		std::cerr << "Error: failed to load opensans font!" << std::endl;
+		return 2;
+	}
+
+	window.setFramerateLimit(CHIP8_CLOCK_SPEED);
+
+	Chip8Frontend frontend(chip8, window, fnt);
+	frontend.setSaveFile(argv[1]);
+
+	if (!playMovieFile.empty()) {
+		frontend.setMovie(&movie, true);
+	} else if (!recordMovieFile.empty()) {
+		movie.start(chip8, seed);
+		frontend.setMovie(&movie, false);
+	}
+
+	frontend.run();
+
+	if (!recordMovieFile.empty() && playMovieFile.empty()) {
+		if (!movie.save(recordMovieFile)) {
+			std::cerr << "Error: failed to write " << recordMovieFile << std::endl;
+			return 1;
+		}
+
+		std::cout << "Recorded " << movie.getFrameCount() << " frames to " << recordMovieFile << std::endl;
+	}
 
 	return 0;
-}
\ No newline at end of file
+#endif
+}